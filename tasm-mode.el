@@ -14,7 +14,11 @@
 
 (defun tasm-keywords ()
   '("put" "mov" "cmp" "jmp" "je" "jne" "jg" "jge" "jl" "jle" "call"
-    "and" "or" "xor" "not" "lsh" "rsh" "add" "sub" "mul" "div" "ret" "out" "hlt"))
+    "and" "or" "xor" "not" "lsh" "rsh" "add" "sub" "mul" "div" "ret" "out" "hlt"
+    "clk" "tsc" "steps" "var"
+    "fadd" "fsub" "fmul" "fdiv" "fsqrt" "fcmp" "itof" "ftoi"
+    "imul" "idiv" "sar" "icmp" "jlt" "jgt"
+    "cocreate" "resume" "yield" "vfork" "vjoin" "vexit" "outraw"))
 
 (defun tasm-font-lock-keywords ()
   (list
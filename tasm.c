@@ -14,13 +14,42 @@
     copies or substantial portions of the Software.
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE // for the register names of ucontext_t (used by watchpoints)
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <math.h>
+#include <limits.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TASM_POSIX 1
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#endif
+
+#if defined(__linux__) && defined(__x86_64__)
+#define TASM_WATCHPOINTS 1
+#include <ucontext.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 typedef unsigned long DWORD;
 typedef unsigned char BYTE;
 
+#include "tasm_stats.h"
+
 /*
 TASM TURING MACHINE & LANGUAGE IMPLEMENTATION
 *********************************************
@@ -60,6 +89,30 @@ TASM INSTRUCTION SET:
     ret                       move ptr to address in stack top    (return)
     out                       display output                      (output)
     hlt                       end program execution               (halt)
+    clk <ADDR>                set monotonic time (ns) to addr     (clock)
+    tsc <ADDR>                set cpu timestamp counter to addr   (timestamp counter)
+    steps <ADDR>              set steps executed so far to addr   (steps)
+    fadd <ADDR1> <ADDR2>      set (1 + 2) to 1, as floats         (float add)
+    fsub <ADDR1> <ADDR2>      set (1 - 2) to 1, as floats         (float subtract)
+    fmul <ADDR1> <ADDR2>      set (1 * 2) to 1, as floats         (float multiply)
+    fdiv <ADDR1> <ADDR2>      set (1 / 2) to 1, as floats         (float divide)
+    fsqrt <ADDR>              set sqrt(addr) to addr, as a float  (float square root)
+    fcmp <ADDR1> <ADDR2>      sets _ZF and _CF as per (1 - 2)     (float compare)
+    itof <ADDR>               convert T_UINT at addr to T_FLOAT   (int to float)
+    ftoi <ADDR>               convert T_FLOAT at addr to T_UINT   (float to int)
+    imul <ADDR1> <ADDR2>      set (1 * 2) to 1, as signed ints    (signed multiply)
+    idiv <ADDR1> <ADDR2>      set (1 / 2) to 1, as signed ints    (signed divide)
+    sar <ADDR1> <ADDR2>       set (1.data >> 2.data) to 1, signed (arithmetic right shift)
+    icmp <ADDR1> <ADDR2>      sets _ZF, _CF, _SF and _OF (1 - 2)  (signed compare)
+    jlt <ADDR>                move ptr to addr if _SF!=_OF        (jump if < signed)
+    jgt <ADDR>                move ptr to addr if _ZF=0 && _SF=_OF (jump if > signed)
+    cocreate <ID> <ADDR>      set up coroutine id to start at addr (create coroutine)
+    resume <ID>               switch to coroutine id              (resume coroutine)
+    yield <ID>                switch back from coroutine id       (yield coroutine)
+    vfork <ADDR>              clone the machine, addr=1 in clone  (fork)
+    vjoin <ADDR>              set the result of a clone to addr   (join)
+    vexit <ADDR>              end a clone, with addr as result    (exit)
+    outraw <ADDR> <LEN> <FMT> write len cells from addr, as binary (raw output)
 */
 
 /*
@@ -72,12 +125,21 @@ STORAGE MEMORY (for storage of data during program execution):
     The first 5 addresses are PRIVILEDGED REGISTERS (TEMP, ZF, CF, DISP, and STK)
     used internally for executing certain TASM instructions
 
+    The last 2 addresses are the sign and overflow flags (SF and OF) set by icmp,
+    and the one before them is the running coroutine (CO). They are kept at the
+    end so that the addresses of existing programs do not move, but a program that
+    used 99997 to 99999 for its own data has to move it (useable memory ends at
+    99996, SAFE_MEM_END)
+
 STACK MEMORY (to store the call stack of the program):
     100000 (STACK_END) to 100999 (STACK)
 
     The stack grows backwards in direction, so as to not overflow into
     display memory by accident
 
+    A program that creates coroutines gives the lowest part of it to them,
+    as one slice per coroutine (see COROUTINES)
+
 DISPLAY MEMORY (for storage of data that will be displayed after program completion):
     101000 (OUT) to 200999 (OUT_END)
 
@@ -105,6 +167,10 @@ INSTRUCTION MEMORY (for storing the program instructions itself):
 #define _DISP 3          // register : lowest free display address
 #define _STK 4           // register : highest free stack position address (i.e. <STACK_TOP_ADDR> - 1)
 #define _SAFE_MEM 5      // start of useable memory
+#define _CO 99997        // register : running coroutine (0 for main, or its id + 1)
+#define _SF 99998        // register : sign flag
+#define _OF 99999        // register : overflow flag
+#define _SAFE_MEM_END 99996 // end of useable memory
 
 // Simple <char*, DWORD> Hash Map implementation
 // (primarily needed for label to address mapping in the assembler)
@@ -166,6 +232,24 @@ DWORD *map_get(Pair **map, const char *key)
     return NULL;
 }
 
+// find the label whose block contains the given address
+// (i.e. the label with the highest address that is <= pos)
+const char *map_find_enclosing(Pair **map, DWORD pos)
+{
+    const char *best = NULL;
+    DWORD best_addr = 0;
+
+    for (int i = 0; i < STACK_SIZE; i++) {
+	for (Pair *curr = map[i]; curr != NULL; curr = curr->next) {
+	    if (curr->value <= pos && (best == NULL || curr->value > best_addr)) {
+		best = curr->key;
+		best_addr = curr->value;
+	    }
+	}
+    }
+    return best;
+}
+
 /*
 TURING MACHINE INSTRUCTION SET
 ******************************
@@ -205,21 +289,93 @@ typedef enum {
 
     /* I/O instructions */
     I_OUT, // 0x18 | prints the data in display memory (upto the first NULL character)
+
+    /* Timing instructions */
+    I_CLK,   // 0x19 | monotonic time in nanoseconds -> current position
+    I_TSC,   // 0x1A | cpu timestamp counter -> current position
+    I_STEPS, // 0x1B | number of steps executed so far -> current position
+
+    /* Debugger instructions */
+    I_TRAP, // 0x1C | breakpoint (the debugger keeps the instruction it replaced)
+
+    /* Floating point instructions */
+    I_FADD,  // 0x1D | (current position data + _ptr.data) -> current position, as floats
+    I_FSUB,  // 0x1E | (current position data - _ptr.data) -> current position, as floats
+    I_FMUL,  // 0x1F | (current position data * _ptr.data) -> current position, as floats
+    I_FDIV,  // 0x20 | (current position data / _ptr.data) -> current position, as floats
+    I_FSQRT, // 0x21 | square root of the current position data, as a float
+    I_FCMP,  // 0x22 | compare the values at _ptr.data and position as floats (and set flags accordingly)
+    I_ITOF,  // 0x23 | convert the current position data from T_UINT to T_FLOAT
+    I_FTOI,  // 0x24 | convert the current position data from T_FLOAT to T_UINT (truncated)
+
+    /* Signed integer instructions */
+    I_IMUL, // 0x25 | (current position data * _ptr.data) -> current position, as signed ints
+    I_IDIV, // 0x26 | (current position data / _ptr.data) -> current position, as signed ints
+    I_SAR,  // 0x27 | arithmetic right shift
+    I_ICMP, // 0x28 | compare the values at _ptr.data and position as signed ints (and set flags accordingly)
+    I_JLT,  // 0x29 | to jump to the address if less (signed)
+    I_JGT,  // 0x2A | to jump to the address if greater (signed)
+
+    /* Coroutine instructions */
+    I_COCREATE, // 0x2B | set up the coroutine _ptr.data to start at the address
+    I_RESUME,   // 0x2C | switch to the coroutine (its id being the data)
+    I_YIELD,    // 0x2D | switch back from the coroutine to the one that resumed it
+
+    /* Fork instructions */
+    I_VFORK, // 0x2E | clone the machine (1 -> current position in the clone, 0 in the original)
+    I_VJOIN, // 0x2F | wait for the oldest clone to end, and set its result to the current position
+    I_VEXIT, // 0x30 | end the clone, with the data at the current position as its result
+
+    /* Raw output instructions */
+    I_OUTRAW, // 0x31 | write the cells from the address as binary (the count and format being _ptr.data)
+
+    /* Hot reload */
+    I_RELOAD, // 0x32 | reload point (see HOT RELOAD, which keeps the instruction it replaced)
 } INSTRUCTION;
 
+// formats of outraw
+#define RAW_U8 0
+#define RAW_U32 1
+#define RAW_U64 2
+
+// names of the instructions (as shown by the debugger)
+static const char *instruction_names[] = {
+    "NONE", "HALT", "JUMP", "CMP", "JE", "JNE", "JG", "JGE", "JL", "JLE", "READ", "WRITE", "CALL", "RET",
+    "AND", "OR", "XOR", "NOT", "LSHIFT", "RSHIFT", "ADD", "SUB", "MUL", "DIV", "OUT",
+    "CLK", "TSC", "STEPS", "TRAP",
+    "FADD", "FSUB", "FMUL", "FDIV", "FSQRT", "FCMP", "ITOF", "FTOI",
+    "IMUL", "IDIV", "SAR", "ICMP", "JLT", "JGT",
+    "COCREATE", "RESUME", "YIELD",
+    "VFORK", "VJOIN", "VEXIT",
+    "OUTRAW",
+    "RELOAD",
+};
+
 /*
 DATA TYPES
 **********
 
-In this architecture, we are defining 2 kinds of types:
+In this architecture, we are defining 4 kinds of types:
 
     T_UINT (Unsigned Integer)
     T_CHAR (Character)
+    T_FLOAT (64 bit IEEE 754 floating point number)
+    T_INT (Signed Integer, two's complement)
 
 We shall control the type simply by using a dtype variable in the BLOCK:
 
     0 --> T_UINT
     1 --> T_CHAR
+    2 --> T_FLOAT
+    3 --> T_INT
+
+A T_FLOAT keeps the bits of a double in the data of the block. Only the
+floating point instructions (and the out instruction) look at these bits as
+a float; every other instruction treats them like any other data.
+
+A T_INT has the same bits as the T_UINT of the same value (so add, sub and
+mul work for both), but it is printed with its sign. Negative literals, and
+the results of imul, idiv and sar, are T_INTs.
 
 (NOTE FOR CONTEXT: In TASM v1, we used actual data types in the instructions
 which were put and moved around with the help of the I_STEAL and I_BURN
@@ -232,6 +388,11 @@ is fundamentally not an instruction [like T_UINT and T_CHAR] shouldn't
 be stored into instruction variables)
 */
 
+#define T_UINT 0
+#define T_CHAR 1
+#define T_FLOAT 2
+#define T_INT 3
+
 /*
 TAPE BLOCK
 **********
@@ -256,13 +417,105 @@ typedef struct {
 
 static TAPE_PTR _ptr;
 
+_Static_assert(sizeof(DWORD) >= sizeof(double), "T_FLOAT needs a DWORD that can hold a double");
+
+// the data of a block, read as a float
+static inline double as_float(DWORD data)
+{
+    double value;
+    memcpy(&value, &data, sizeof(value));
+    return value;
+}
+
+// the data of a block, holding a float
+static inline DWORD float_bits(double value)
+{
+    DWORD data = 0;
+    memcpy(&data, &value, sizeof(value));
+    return data;
+}
+
 /*
 IMPLEMENTATION BEGINS HERE
 **************************
 */
 
+#define PAGE_SIZE 4096
+
+// (page aligned, so that pages of the tape can be protected on their own)
+#ifdef __GNUC__
+static BLOCK tape[STORE_SIZE + STACK_SIZE + DISPLAY_SIZE + INSTR_SIZE] __attribute__((aligned(PAGE_SIZE)));
+#else
 static BLOCK tape[STORE_SIZE + STACK_SIZE + DISPLAY_SIZE + INSTR_SIZE];
+#endif
+static Pair *label_to_address_map[STACK_SIZE];
+static int source_line[INSTR_SIZE]; // source line each cell of instruction memory was assembled from
+static DWORD steps = 0; // number of instructions executed so far
+static int exact_steps = 0; // whether steps is kept up to date after every instruction (see run())
+static DWORD source_lines = 0; // number of lines read by the assembler
+static DWORD output_bytes = 0; // number of bytes printed by output()
+static DWORD output_shown_until = 0; // output before this step was already shown (the debugger can re-execute it)
 int memdump = 0; // whether to generate memory dump files after execution is complete
+int bench = 0; // whether to report benchmark measurements after execution is complete
+int optimize = 0; // whether to optimize the program while assembling it
+int compress = 0; // whether to compress the cold pages of the tape (see COLD PAGE COMPRESSION)
+static const char *reload_file = NULL; // program to reassemble on SIGHUP (see HOT RELOAD)
+
+/*
+COROUTINES
+**********
+
+"cocreate <ID> <LABEL>" sets up coroutine ID (0 to COROUTINE_MAX - 1) to start at LABEL,
+"resume <ID>" switches to it, and "yield <ID>" (from within it) switches back to whoever
+resumed it, right after their resume. A coroutine keeps its own position and call stack
+across the switches, so a producer and a consumer can each be written as a plain loop.
+
+Every coroutine has a slice of COROUTINE_STACK_SIZE cells at the bottom of the stack memory
+(once a program has a cocreate, the stack of main stops above the slices). The top cells of
+a slice hold the state of its coroutine, and below them is its call stack:
+
+    <TOP>       its saved _STK (0 while it is running, or was never created)
+    <TOP> - 1   its saved position
+    <TOP> - 2   the coroutine that resumed it (in the form of _CO)
+    <TOP> - 3   the _STK of that coroutine
+    <TOP> - 4   the position to return to on a yield
+
+So a switch is a single instruction, which only moves a few cells around, and the whole
+state stays on the tape (for checkpoints, snapshots and state traces).
+*/
+
+#define COROUTINE_MAX 16
+#define COROUTINE_STACK_SIZE 32
+#define COROUTINE_STATE 5 // cells at the top of a slice that are not part of its stack
+
+static DWORD stack_floor = _STACK_END; // lowest stack address of main
+
+// the top cell of the stack slice of a coroutine
+static inline DWORD coroutine_top(DWORD id)
+{
+    return _STACK_END + (id + 1) * COROUTINE_STACK_SIZE - 1;
+}
+
+// the lowest stack address of the running coroutine (or main)
+static inline DWORD stack_floor_of(const BLOCK *reg)
+{
+    return reg[_CO].data ? _STACK_END + (reg[_CO].data - 1) * COROUTINE_STACK_SIZE : stack_floor;
+}
+
+// the start point of the stack of the running coroutine (or main)
+static inline DWORD stack_start_of(const BLOCK *reg)
+{
+    return reg[_CO].data ? coroutine_top(reg[_CO].data - 1) - COROUTINE_STATE : _STACK;
+}
+
+// whether a coroutine is running (or waiting for one that it resumed to yield)
+int coroutine_running(const BLOCK *reg, DWORD id)
+{
+    for (DWORD co = reg[_CO].data; co != 0; co = tape[coroutine_top(co - 1) - 2].data) {
+	if (co == id + 1) return 1;
+    }
+    return 0;
+}
 
 // to load instructions that read the value stored at an address, and pass it into the upcoming instruction
 // (overwrite_at: the number of steps ahead to overwrite at)
@@ -333,6 +586,94 @@ void load_instruction(const char *ins, DWORD a1, DWORD a2, BYTE data_type, int d
 	return;
     }
 
+    if (strcmp(ins, "clk") == 0) {
+	if (deref_1) load_deref_instructions(a1, 1);
+
+	tape[_ptr.pos].ins = I_CLK;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
+
+    if (strcmp(ins, "tsc") == 0) {
+	if (deref_1) load_deref_instructions(a1, 1);
+
+	tape[_ptr.pos].ins = I_TSC;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
+
+    if (strcmp(ins, "steps") == 0) {
+	if (deref_1) load_deref_instructions(a1, 1);
+
+	tape[_ptr.pos].ins = I_STEPS;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
+
+    if (strcmp(ins, "vfork") == 0 || strcmp(ins, "vjoin") == 0 || strcmp(ins, "vexit") == 0) {
+	if (deref_1) load_deref_instructions(a1, 1);
+
+	tape[_ptr.pos].ins = strcmp(ins, "vfork") == 0 ? I_VFORK : strcmp(ins, "vjoin") == 0 ? I_VJOIN : I_VEXIT;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
+
+    if (strcmp(ins, "fsqrt") == 0) {
+	if (deref_1) load_deref_instructions(a1, 1);
+
+	tape[_ptr.pos].ins = I_FSQRT;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
+
+    if (strcmp(ins, "itof") == 0) {
+	if (deref_1) load_deref_instructions(a1, 1);
+
+	tape[_ptr.pos].ins = I_ITOF;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
+
+    if (strcmp(ins, "ftoi") == 0) {
+	if (deref_1) load_deref_instructions(a1, 1);
+
+	tape[_ptr.pos].ins = I_FTOI;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
+
+    if (strcmp(ins, "jlt") == 0) {
+	if (deref_1) load_deref_instructions(a1, 1);
+
+	tape[_ptr.pos].ins = I_JLT;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
+
+    if (strcmp(ins, "jgt") == 0) {
+	if (deref_1) load_deref_instructions(a1, 1);
+
+	tape[_ptr.pos].ins = I_JGT;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
+
+    if (strcmp(ins, "resume") == 0 || strcmp(ins, "yield") == 0) {
+	tape[_ptr.pos].ins = strcmp(ins, "resume") == 0 ? I_RESUME : I_YIELD;
+	tape[_ptr.pos].data = a2;
+	_ptr.pos++;
+	return;
+    }
+
     if (strcmp(ins, "je") == 0) {
 	if (deref_1) load_deref_instructions(a1, 1);
 
@@ -421,6 +762,41 @@ void load_instruction(const char *ins, DWORD a1, DWORD a2, BYTE data_type, int d
 	return;
     }
 
+    if (strcmp(ins, "cocreate") == 0) {
+	if (deref_1) load_deref_instructions(a1, 3);
+	stack_floor = _STACK_END + COROUTINE_MAX * COROUTINE_STACK_SIZE;
+
+	tape[_ptr.pos].ins = I_NONE;
+	tape[_ptr.pos].data = a2;
+	_ptr.pos++;
+
+	tape[_ptr.pos].ins = I_READ;
+	tape[_ptr.pos].data = _ptr.pos - 1;
+	_ptr.pos++;
+
+	tape[_ptr.pos].ins = I_COCREATE;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
+
+    if (strcmp(ins, "outraw") == 0) {
+	if (deref_1) load_deref_instructions(a1, 3);
+
+	tape[_ptr.pos].ins = I_NONE;
+	tape[_ptr.pos].data = a2;
+	_ptr.pos++;
+
+	tape[_ptr.pos].ins = I_READ;
+	tape[_ptr.pos].data = _ptr.pos - 1;
+	_ptr.pos++;
+
+	tape[_ptr.pos].ins = I_OUTRAW;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
+
     if (strcmp(ins, "mov") == 0) {
 	if (deref_2) load_deref_instructions(a2, deref_1 ? 3 : 1);
 	if (deref_1) load_deref_instructions(a1, 2);
@@ -561,351 +937,4314 @@ void load_instruction(const char *ins, DWORD a1, DWORD a2, BYTE data_type, int d
 	_ptr.pos++;
 	return;
     }
-}
 
-// create three files displaying the entire memory contents
-void generate_memory_dump()
-{
-    // write store file
-    FILE *store_file = fopen("__STORE_DUMP.tasm.txt", "w");
-    if (store_file == NULL) {
-	fprintf(stderr, "ERROR: Failed to create store dump file");
-	exit(1);
-    }
+    if (strcmp(ins, "fadd") == 0) {
+	if (deref_2) load_deref_instructions(a2, deref_1 ? 3 : 1);
+	if (deref_1) load_deref_instructions(a1, 2);
 
-    // write line by line from store memory
-    for (DWORD i = _MEM; i <= _MEM_END; i++) {
-	fprintf(store_file, "0x%08lx [_MEM + %010lu] \t0x%08lx  0x%08lx  %u\n", i, i - _MEM, tape[i].ins, tape[i].data, tape[i].dtype);
-    }
-    fclose(store_file);
+	tape[_ptr.pos].ins = I_READ;
+	tape[_ptr.pos].data = a2;
+	_ptr.pos++;
 
-    // write display file
-    FILE *display_file = fopen("__DISPLAY_DUMP.tasm.txt", "w");
-    if (store_file == NULL) {
-	fprintf(stderr, "ERROR: Failed to create display dump file");
-	exit(1);
+	tape[_ptr.pos].ins = I_FADD;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
     }
 
-    // write line by line from display memory
-    for (DWORD i = _OUT; i <= _OUT_END; i++) {
-	fprintf(display_file, "0x%08lx [_OUT + %010lu] \t0x%08lx  0x%08lx  %u\n", i, i - _OUT, tape[i].ins, tape[i].data, tape[i].dtype);
-    }
-    fclose(display_file);
+    if (strcmp(ins, "fsub") == 0) {
+	if (deref_2) load_deref_instructions(a2, deref_1 ? 3 : 1);
+	if (deref_1) load_deref_instructions(a1, 2);
 
-    // write instruction file
-    FILE *ins_file = fopen("__INSTRUCTION_DUMP.tasm.txt", "w");
-    if (ins_file == NULL) {
-	fprintf(stderr, "ERROR: Failed to create instruction dump file");
-	exit(1);
-    }
+	tape[_ptr.pos].ins = I_READ;
+	tape[_ptr.pos].data = a2;
+	_ptr.pos++;
 
-    // write line by line from instruction memory
-    for (DWORD i = _MAIN; i <= _END; i++) {
-	fprintf(ins_file, "0x%08lx [_MAIN + %010lu] \t0x%08lx  0x%08lx  %u\n", i, i - _MAIN, tape[i].ins, tape[i].data, tape[i].dtype);
+	tape[_ptr.pos].ins = I_FSUB;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
     }
-    fclose(ins_file);
-}
 
+    if (strcmp(ins, "fmul") == 0) {
+	if (deref_2) load_deref_instructions(a2, deref_1 ? 3 : 1);
+	if (deref_1) load_deref_instructions(a1, 2);
 
-// ASSEMBLER
-//
-// read, parse, and load the tasm program into instruction memory
-void assemble_tasm(const char *tasm_file_name)
-{
-    FILE *tasm_file = fopen(tasm_file_name, "r");
-    if (!tasm_file) {
-	fprintf(stderr, "ERROR: .tasm file not found");
-	exit(1);
+	tape[_ptr.pos].ins = I_READ;
+	tape[_ptr.pos].data = a2;
+	_ptr.pos++;
+
+	tape[_ptr.pos].ins = I_FMUL;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
     }
 
-    _ptr.pos = _MAIN;
-    char line[256];
+    if (strcmp(ins, "fdiv") == 0) {
+	if (deref_2) load_deref_instructions(a2, deref_1 ? 3 : 1);
+	if (deref_1) load_deref_instructions(a1, 2);
 
-    Pair *label_to_address_map[STACK_SIZE];
-    init_map(label_to_address_map);
+	tape[_ptr.pos].ins = I_READ;
+	tape[_ptr.pos].data = a2;
+	_ptr.pos++;
 
-    // load line by line
-    int line_num = 0;
+	tape[_ptr.pos].ins = I_FDIV;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
 
-    while (fgets(line, sizeof(line), tasm_file) != NULL) {
-	line_num++;
+    if (strcmp(ins, "fcmp") == 0) {
+	if (deref_2) load_deref_instructions(a2, deref_1 ? 3 : 1);
+	if (deref_1) load_deref_instructions(a1, 2);
 
-	char *comment_start = strstr(line, "//");
-	if (comment_start != NULL) {
-            *comment_start = '\0';  // terminate string at the start of the comment
-	}
+	tape[_ptr.pos].ins = I_READ;
+	tape[_ptr.pos].data = a2;
+	_ptr.pos++;
 
-	char ins[100] = "", first[100] = "", second[200] = "";
+	tape[_ptr.pos].ins = I_FCMP;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
 
-	sscanf(line, "%s %s %[^\n]", ins, first, second);
+    if (strcmp(ins, "imul") == 0) {
+	if (deref_2) load_deref_instructions(a2, deref_1 ? 3 : 1);
+	if (deref_1) load_deref_instructions(a1, 2);
 
-	size_t ins_len = strlen(ins);
-	if (ins_len == 0) continue;
+	tape[_ptr.pos].ins = I_READ;
+	tape[_ptr.pos].data = a2;
+	_ptr.pos++;
 
-	// check for instruction memory overflow
-	if (_ptr.pos > _END) {
-	    fprintf(stderr, "ERROR: Memory overflow occurred [Line %d]. Instruction memory limit exceeded.", line_num);
-	    if (memdump) generate_memory_dump();
-	    exit(1);
-	}
+	tape[_ptr.pos].ins = I_IMUL;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
 
-	// for labels
-	if (ins[ins_len - 1] == ':') {
+    if (strcmp(ins, "idiv") == 0) {
+	if (deref_2) load_deref_instructions(a2, deref_1 ? 3 : 1);
+	if (deref_1) load_deref_instructions(a1, 2);
+
+	tape[_ptr.pos].ins = I_READ;
+	tape[_ptr.pos].data = a2;
+	_ptr.pos++;
+
+	tape[_ptr.pos].ins = I_IDIV;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
+
+    if (strcmp(ins, "sar") == 0) {
+	if (deref_2) load_deref_instructions(a2, deref_1 ? 3 : 1);
+	if (deref_1) load_deref_instructions(a1, 2);
+
+	tape[_ptr.pos].ins = I_READ;
+	tape[_ptr.pos].data = a2;
+	_ptr.pos++;
+
+	tape[_ptr.pos].ins = I_SAR;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
+
+    if (strcmp(ins, "icmp") == 0) {
+	if (deref_2) load_deref_instructions(a2, deref_1 ? 3 : 1);
+	if (deref_1) load_deref_instructions(a1, 2);
+
+	tape[_ptr.pos].ins = I_READ;
+	tape[_ptr.pos].data = a2;
+	_ptr.pos++;
+
+	tape[_ptr.pos].ins = I_ICMP;
+	tape[_ptr.pos].data = a1;
+	_ptr.pos++;
+	return;
+    }
+}
+
+// remember the source line of the cells loaded from ins_start upto _ptr.pos
+void mark_source_line(DWORD ins_start, int line_num)
+{
+    for (DWORD i = ins_start; i < _ptr.pos && i <= _END; i++) source_line[i - _MAIN] = line_num;
+}
+
+// create three files displaying the entire memory contents
+// (the suffix is inserted into the file names, before the extension)
+void write_memory_dump(const char *suffix)
+{
+    char file_name[128];
+
+    // write store file
+    snprintf(file_name, sizeof(file_name), "__STORE_DUMP%s.tasm.txt", suffix);
+    FILE *store_file = fopen(file_name, "w");
+    if (store_file == NULL) {
+	fprintf(stderr, "ERROR: Failed to create store dump file");
+	exit(1);
+    }
+
+    // write line by line from store memory
+    for (DWORD i = _MEM; i <= _MEM_END; i++) {
+	fprintf(store_file, "0x%08lx [_MEM + %010lu] \t0x%08lx  0x%08lx  %u\n", i, i - _MEM, tape[i].ins, tape[i].data, tape[i].dtype);
+    }
+    fclose(store_file);
+
+    // write display file
+    snprintf(file_name, sizeof(file_name), "__DISPLAY_DUMP%s.tasm.txt", suffix);
+    FILE *display_file = fopen(file_name, "w");
+    if (display_file == NULL) {
+	fprintf(stderr, "ERROR: Failed to create display dump file");
+	exit(1);
+    }
+
+    // write line by line from display memory
+    for (DWORD i = _OUT; i <= _OUT_END; i++) {
+	fprintf(display_file, "0x%08lx [_OUT + %010lu] \t0x%08lx  0x%08lx  %u\n", i, i - _OUT, tape[i].ins, tape[i].data, tape[i].dtype);
+    }
+    fclose(display_file);
+
+    // write instruction file
+    snprintf(file_name, sizeof(file_name), "__INSTRUCTION_DUMP%s.tasm.txt", suffix);
+    FILE *ins_file = fopen(file_name, "w");
+    if (ins_file == NULL) {
+	fprintf(stderr, "ERROR: Failed to create instruction dump file");
+	exit(1);
+    }
+
+    // write line by line from instruction memory
+    for (DWORD i = _MAIN; i <= _END; i++) {
+	fprintf(ins_file, "0x%08lx [_MAIN + %010lu] \t0x%08lx  0x%08lx  %u\n", i, i - _MAIN, tape[i].ins, tape[i].data, tape[i].dtype);
+    }
+    fclose(ins_file);
+}
+
+void generate_memory_dump()
+{
+    write_memory_dump("");
+}
+
+/*
+ASSEMBLER
+*********
+
+The assembler works in three stages:
+
+    (1) PARSE : every line of the .tasm file is read into an ASM_LINE (strings are split
+		into one "put" per character)
+    (2) OPTIMIZE : only with the "-O" flag (see the OPTIMIZER section below)
+    (3) EMIT : every ASM_LINE is loaded onto the tape, by load_instruction()
+
+Labels are only resolved into addresses when the lines are emitted, so the optimizer is free
+to add or remove lines. (As a result, labels can also be used before they are defined.)
+*/
+
+typedef struct {
+    char ins[16];   // the tasm instruction ("" for a label definition, or a removed line)
+    char *label;    // the label defined, or the label (or variable) used as the first address
+    char *var_2;    // the variable used as the second address (or value)
+    DWORD a1, a2;   // (offsets into the variables, until they are allocated)
+    BYTE data_type;
+    int deref_1, deref_2;
+    int line_num;
+} ASM_LINE;
+
+static ASM_LINE *asm_lines = NULL;
+static int asm_count = 0, asm_capacity = 0;
+static DWORD code_end = _END; // (the optimizer keeps its constants at the end of instruction memory)
+static int forward_labels = 0; // whether a label is used before it is defined
+
+void append_line(ASM_LINE **lines, int *count, int *capacity, ASM_LINE line)
+{
+    if (*count == *capacity) {
+	*capacity = *capacity ? *capacity * 2 : 1024;
+	*lines = realloc(*lines, sizeof(ASM_LINE) * *capacity);
+    }
+    (*lines)[(*count)++] = line;
+}
+
+void add_asm_line(ASM_LINE line)
+{
+    append_line(&asm_lines, &asm_count, &asm_capacity, line);
+}
+
+int is_jump(const char *ins)
+{
+    static const char *jumps[] = { "jmp", "je", "jne", "jg", "jge", "jl", "jle", "jlt", "jgt", "call" };
+    for (size_t i = 0; i < sizeof(jumps) / sizeof(jumps[0]); i++) {
+	if (strcmp(ins, jumps[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// whether the instruction switches to another coroutine (coming back to the next line later, like a call)
+int is_switch(const char *ins)
+{
+    return strcmp(ins, "resume") == 0 || strcmp(ins, "yield") == 0;
+}
+
+// whether the instruction writes to its first address
+int writes_first(const char *ins)
+{
+    static const char *writers[] = { "put", "mov", "and", "or", "xor", "not", "lsh", "rsh",
+				     "add", "sub", "mul", "div", "clk", "tsc", "steps", "vfork", "vjoin",
+				     "fadd", "fsub", "fmul", "fdiv", "fsqrt", "itof", "ftoi",
+				     "imul", "idiv", "sar" };
+    for (size_t i = 0; i < sizeof(writers) / sizeof(writers[0]); i++) {
+	if (strcmp(ins, writers[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// whether the instruction has a second address (rather than a value, or nothing)
+int reads_second(const char *ins)
+{
+    return writes_first(ins) && strcmp(ins, "put") != 0 && strcmp(ins, "not") != 0 &&
+	strcmp(ins, "clk") != 0 && strcmp(ins, "tsc") != 0 && strcmp(ins, "steps") != 0 &&
+	strcmp(ins, "fsqrt") != 0 && strcmp(ins, "itof") != 0 && strcmp(ins, "ftoi") != 0 &&
+	strcmp(ins, "vfork") != 0 && strcmp(ins, "vjoin") != 0;
+}
+
+int is_storage(DWORD addr)
+{
+    return addr >= _SAFE_MEM && addr <= _SAFE_MEM_END;
+}
+
+/*
+VARIABLES
+*********
+
+"var <NAME> [<SIZE>]" declares a variable of SIZE cells (1 by default). Its name can then be
+used in place of a storage address, as "<NAME>" (its first cell), "<NAME>+<N>" (its N-th cell)
+or "[<NAME>]" (dereferenced). "&<NAME>" is its address, as a value (e.g. "put ptr &name").
+
+The assembler allocates the cells of the variables itself, once the whole program is parsed.
+They are placed after the highest storage address that the program uses directly (so that
+hand-written addresses keep working), starting on a cache line boundary. Every use of a
+variable is counted (a use inside a loop counts LOOP_WEIGHT times as much, for every loop
+it is in), and:
+
+    (1) the scalars are packed together first, the most used ones first, so that the hot
+	ones share cache lines
+    (2) then the arrays, each starting on a new cache line, the most used ones first
+    (3) the variables that are never used come last
+*/
+
+#define CACHE_LINE_CELLS 8 // (8 cells of 24 bytes make up 3 whole cache lines of 64 bytes)
+#define LOOP_WEIGHT 8
+
+typedef struct {
+    char *name;
+    DWORD size;
+    DWORD uses;
+    DWORD addr;
+} VARIABLE;
+
+static VARIABLE *variables = NULL;
+static int variable_count = 0;
+static Pair *variable_map[STACK_SIZE]; // name -> index into variables
+static VARIABLE *kept_variables = NULL; // the variables of the running program, while it is reloaded
+static int kept_count = 0;
+
+int is_variable_name(const char *text)
+{
+    if (text[0] == '&') text++;
+    return (text[0] >= 'a' && text[0] <= 'z') || (text[0] >= 'A' && text[0] <= 'Z') || text[0] == '_';
+}
+
+// whether the text is a float literal (like 1.5, -0.25 or 2e10), rather than an unsigned int
+int is_float_literal(const char *text)
+{
+    const char *digits = text[0] == '-' || text[0] == '+' ? text + 1 : text;
+    if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) return 0;
+    if (!(digits[0] >= '0' && digits[0] <= '9') && digits[0] != '.') return 0;
+
+    char *end;
+    strtod(text, &end);
+    return *end == '\0' && strpbrk(text, ".eE") != NULL;
+}
+
+void declare_variable(const char *name, const char *size, int line_num)
+{
+    if (!is_variable_name(name) || name[0] == '&' || strchr(name, '+') != NULL) {
+	fprintf(stderr, "ERROR: Invalid variable name [Line %d]", line_num);
+	exit(1);
+    }
+    if (map_get(variable_map, name) != NULL) {
+	fprintf(stderr, "ERROR: Duplicate variable definitions encountered [Line %d]", line_num);
+	exit(1);
+    }
+
+    DWORD cells = strtoul(size[0] == '[' ? size + 1 : size, NULL, 0);
+    if (size[0] == '\0') cells = 1;
+    if (cells == 0 || cells > STORE_SIZE) {
+	fprintf(stderr, "ERROR: Invalid variable size [Line %d]", line_num);
+	exit(1);
+    }
+
+    variables = realloc(variables, sizeof(VARIABLE) * (variable_count + 1));
+    variables[variable_count] = (VARIABLE){ strdup(name), cells, 0, 0 };
+    map_insert(variable_map, name, variable_count);
+    variable_count++;
+}
+
+// find the variable referred to as "<NAME>" or "<NAME>+<N>" (and the offset N)
+VARIABLE *find_variable(const char *ref, DWORD *offset)
+{
+    char name[100];
+    size_t len = strcspn(ref, "+");
+    if (len >= sizeof(name)) return NULL;
+
+    strncpy(name, ref, len);
+    name[len] = '\0';
+    *offset = ref[len] == '+' ? strtoul(ref + len + 1, NULL, 0) : 0;
+
+    DWORD *index = map_get(variable_map, name);
+    return index != NULL ? &variables[*index] : NULL;
+}
+
+// storage address of a cell, given as a number or a variable (for the debugger and -watch)
+DWORD cell_address(const char *text, char **end)
+{
+    DWORD offset;
+    VARIABLE *var = is_variable_name(text) ? find_variable(text, &offset) : NULL;
+    if (var == NULL) return strtoul(text, end, 0);
+
+    if (end != NULL) *end = (char *)text + strcspn(text, ",");
+    return var->addr + offset;
+}
+
+int compare_variables(const void *a, const void *b)
+{
+    const VARIABLE *x = *(VARIABLE * const *)a, *y = *(VARIABLE * const *)b;
+
+    // (scalars before arrays, and unused variables last)
+    int x_rank = x->uses == 0 ? 2 : x->size > 1, y_rank = y->uses == 0 ? 2 : y->size > 1;
+    if (x_rank != y_rank) return x_rank - y_rank;
+    if (x->uses != y->uses) return x->uses < y->uses ? 1 : -1;
+    return x < y ? -1 : 1;
+}
+
+void allocate_variables()
+{
+    if (variable_count == 0) return;
+
+    // the loop depth of every line (a loop being the lines between a label, and a jump back to it)
+    int *depth = calloc(asm_count + 1, sizeof(int));
+    for (int b = 0; b < asm_count; b++) {
+	if (!is_jump(asm_lines[b].ins) || asm_lines[b].label == NULL) continue;
+	for (int l = 0; l < b; l++) {
+	    if (asm_lines[l].ins[0] == '\0' && asm_lines[l].label != NULL && strcmp(asm_lines[l].label, asm_lines[b].label) == 0) {
+		depth[l]++;
+		depth[b + 1]--;
+		break;
+	    }
+	}
+    }
+
+    DWORD highest = _SAFE_MEM - 1, offset;
+    for (int i = 0, d = 0; i < asm_count; i++) {
+	ASM_LINE *line = &asm_lines[i];
+	d += depth[i];
+
+	DWORD weight = 1;
+	for (int k = 0; k < d && k < 5; k++) weight *= LOOP_WEIGHT;
+
+	VARIABLE *var;
+	if (line->label != NULL && line->ins[0] != '\0' && (var = find_variable(line->label, &offset)) != NULL) var->uses += weight;
+	if (line->var_2 != NULL && (var = find_variable(line->var_2, &offset)) != NULL) var->uses += weight;
+
+	// the highest storage address used directly
+	if (line->ins[0] != '\0' && line->label == NULL && is_storage(line->a1) && line->a1 > highest) highest = line->a1;
+	// (the value of outraw is its count and format, not an address)
+	if (line->var_2 == NULL && line->data_type == 0 && strcmp(line->ins, "outraw") != 0 &&
+	    is_storage(line->a2) && line->a2 > highest) highest = line->a2;
+    }
+    free(depth);
+
+    // (on a reload, the variables keep their cells, and new ones are placed after all the old ones)
+    for (int k = 0; k < kept_count; k++) {
+	if (kept_variables[k].addr + kept_variables[k].size - 1 > highest) highest = kept_variables[k].addr + kept_variables[k].size - 1;
+    }
+
+    VARIABLE **order = malloc(sizeof(VARIABLE *) * variable_count);
+    for (int i = 0; i < variable_count; i++) order[i] = &variables[i];
+    qsort(order, variable_count, sizeof(VARIABLE *), compare_variables);
+
+    DWORD next = (highest / CACHE_LINE_CELLS + 1) * CACHE_LINE_CELLS;
+    for (int i = 0; i < variable_count; i++) {
+	VARIABLE *kept = NULL;
+	for (int k = 0; k < kept_count && kept == NULL; k++) {
+	    if (kept_variables[k].size == order[i]->size && strcmp(kept_variables[k].name, order[i]->name) == 0) kept = &kept_variables[k];
+	}
+	if (kept != NULL) {
+	    order[i]->addr = kept->addr;
+	    continue;
+	}
+
+	if (order[i]->size > 1) next = (next + CACHE_LINE_CELLS - 1) / CACHE_LINE_CELLS * CACHE_LINE_CELLS;
+	order[i]->addr = next;
+	next += order[i]->size;
+    }
+    free(order);
+
+    if (next - 1 > _SAFE_MEM_END) {
+	fprintf(stderr, "ERROR: Not enough storage memory for the variables");
+	exit(1);
+    }
+}
+
+// replace the variables used by the lines with their addresses
+void resolve_variables()
+{
+    for (int i = 0; i < asm_count; i++) {
+	ASM_LINE *line = &asm_lines[i];
+	DWORD offset;
+	VARIABLE *var;
+
+	if (line->ins[0] != '\0' && line->label != NULL) {
+	    var = find_variable(line->label, &offset);
+	    if (var == NULL && line->deref_1) {
+		fprintf(stderr, "ERROR: Undefined variable encountered [Line %d]", line->line_num);
+		exit(1);
+	    }
+	    if (var != NULL) {
+		line->a1 += offset;
+		if (line->a1 >= var->size) {
+		    fprintf(stderr, "ERROR: Index out of bounds for variable \"%s\" [Line %d]", var->name, line->line_num);
+		    exit(1);
+		}
+		line->a1 += var->addr;
+		line->label = NULL;
+	    }
+	}
+
+	if (line->var_2 != NULL) {
+	    var = find_variable(line->var_2, &offset);
+	    if (var == NULL) {
+		fprintf(stderr, "ERROR: Undefined variable encountered [Line %d]", line->line_num);
+		exit(1);
+	    }
+	    if (offset >= var->size) {
+		fprintf(stderr, "ERROR: Index out of bounds for variable \"%s\" [Line %d]", var->name, line->line_num);
+		exit(1);
+	    }
+	    line->a2 = var->addr + offset;
+	    line->var_2 = NULL;
+	}
+    }
+
+    // (only labels are left now, so check if any is used before it is defined)
+    Pair *seen[STACK_SIZE];
+    init_map(seen);
+    for (int i = 0; i < asm_count; i++) {
+	ASM_LINE *line = &asm_lines[i];
+	if (line->label == NULL) continue;
+
+	if (line->ins[0] == '\0') map_insert(seen, line->label, i);
+	else if (map_get(seen, line->label) == NULL) forward_labels = 1;
+    }
+}
+
+void parse_tasm(const char *tasm_file_name)
+{
+    FILE *tasm_file = fopen(tasm_file_name, "r");
+    if (!tasm_file) {
+	fprintf(stderr, "ERROR: .tasm file not found");
+	exit(1);
+    }
+
+    char line[256];
+
+    init_map(label_to_address_map);
+    init_map(variable_map);
+
+    // load line by line
+    int line_num = 0;
+
+    while (fgets(line, sizeof(line), tasm_file) != NULL) {
+	line_num++;
+
+	char *comment_start = strstr(line, "//");
+	if (comment_start != NULL) {
+            *comment_start = '\0';  // terminate string at the start of the comment
+	}
+
+	char ins[100] = "", first[100] = "", second[200] = "";
+
+	sscanf(line, "%s %s %[^\n]", ins, first, second);
+
+	size_t ins_len = strlen(ins);
+	if (ins_len == 0) continue;
+
+	ASM_LINE parsed = { "", NULL, NULL, 0, 0, 0, 0, 0, line_num };
+
+	// for labels
+	if (ins[ins_len - 1] == ':') {
 	    char *label = malloc(sizeof(char) * ins_len);
 	    strncpy(label, ins, ins_len - 1); // remove the ':' from the label
 	    label[ins_len - 1] = '\0';
 
-	    if (map_get(label_to_address_map, label) != NULL) {
-		fprintf(stderr, "ERROR: Duplicate label definitions encountered [Line %d]", line_num);
-		exit(1);
-	    }
+	    if (map_get(label_to_address_map, label) != NULL) {
+		fprintf(stderr, "ERROR: Duplicate label definitions encountered [Line %d]", line_num);
+		exit(1);
+	    }
+
+	    map_insert(label_to_address_map, label, 0); // (the address is set when emitted)
+	    parsed.label = label;
+	    add_asm_line(parsed);
+	    continue;
+	}
+
+	// for variable declarations
+	if (strcmp(ins, "var") == 0) {
+	    declare_variable(first, second, line_num);
+	    continue;
+	}
+
+	strncpy(parsed.ins, ins, sizeof(parsed.ins) - 1);
+
+	// (the id of a coroutine is kept as the value of the line, and the label of cocreate as its first address)
+	if (strcmp(ins, "cocreate") == 0 || strcmp(ins, "resume") == 0 || strcmp(ins, "yield") == 0) {
+	    char id[100];
+	    strcpy(id, first);
+	    if (strcmp(ins, "cocreate") != 0) first[0] = '\0';
+	    else if (sscanf(second, "%99s", first) != 1) {
+		fprintf(stderr, "ERROR: cocreate needs a label to start the coroutine at [Line %d]", line_num);
+		exit(1);
+	    }
+	    strcpy(second, id);
+
+	    char *end;
+	    if (id[0] == '\0' || strtoul(id, &end, 0) >= COROUTINE_MAX || *end != '\0') {
+		fprintf(stderr, "ERROR: Invalid coroutine id (it must be below %d) [Line %d]", COROUTINE_MAX, line_num);
+		exit(1);
+	    }
+	}
+
+	// (the count and format of outraw are packed into its value, see output_raw())
+	if (strcmp(ins, "outraw") == 0) {
+	    char count[100], format[100], *end;
+	    int code = -1;
+	    if (sscanf(second, "%99s %99s", count, format) == 2) {
+		if (strcmp(format, "u8") == 0) code = RAW_U8;
+		else if (strcmp(format, "u32") == 0) code = RAW_U32;
+		else if (strcmp(format, "u64") == 0) code = RAW_U64;
+	    }
+	    DWORD cells = code < 0 ? 0 : strtoul(count, &end, 0);
+	    if (code < 0 || *end != '\0' || cells == 0 || cells > _END) {
+		fprintf(stderr, "ERROR: outraw needs a count of cells and a format (u8, u32 or u64) [Line %d]", line_num);
+		exit(1);
+	    }
+	    parsed.a2 = cells << 2 | code;
+	    second[0] = '\0';
+	}
+
+	size_t first_len = strlen(first);
+
+	if (first[0] == '0' && first[1] == 'x') {
+	    parsed.a1 = strtoul(first, NULL, 16);
+	} else if (first[0] == '[' && first[1] == '0' && first[2] == 'x' && first[first_len - 1] == ']') {
+	    // mark the first address for dereferencing
+	    parsed.deref_1 = 1;
+
+	    char *addr_contained = malloc(first_len - 1);
+	    strncpy(addr_contained, first + 1, first_len - 2); // get the number without the square brackets
+	    addr_contained[first_len - 2] = '\0';
+
+	    parsed.a1 = strtoul(addr_contained, NULL, 16);
+	} else if (first[0] == '[' && first[first_len - 1] == ']') {
+	    // dereferencing a variable
+	    parsed.deref_1 = 1;
+	    parsed.label = strndup(first + 1, first_len - 2);
+	} else if (first_len > 0) {
+	    // label handling (for the case of "call" instruction), or a variable
+	    parsed.label = strdup(first);
+	}
+
+        size_t len = strlen(second);
+
+	if (second[0] == '"') { // for char / string data
+	    // escape sequences are decoded here, so every display cell holds the final byte
+	    for (char *c = second + 1; *c != '\0' && *c != '"'; c++) {
+		DWORD byte = (unsigned char)*c;
+
+		if (*c == '\\') {
+		    c++;
+		    switch (*c) {
+		    case 'n': byte = '\n'; break;
+		    case 'r': byte = '\r'; break;
+		    case 't': byte = '\t'; break;
+		    case '0': byte = '\0'; break;
+		    case '\\': byte = '\\'; break;
+		    case '"': byte = '"'; break;
+		    case 'x': {
+			if (!isxdigit((unsigned char)c[1]) || !isxdigit((unsigned char)c[2])) {
+			    fprintf(stderr, "ERROR: Expected two hex digits after \\x [Line %d]", line_num);
+			    exit(1);
+			}
+			char hex[3] = { c[1], c[2], '\0' };
+			byte = strtoul(hex, NULL, 16);
+			c += 2;
+			break;
+		    }
+		    default:
+			fprintf(stderr, "ERROR: Unknown escape sequence \\%c [Line %d]", *c, line_num);
+			exit(1);
+		    }
+		}
+
+		parsed.a2 = byte;
+		parsed.data_type = T_CHAR;
+
+		add_asm_line(parsed);
+		parsed.a1++;
+	    }
+	    continue;
+	} else if (second[0] == '[' && second[len - 1] == ']') { // for unsigned int address enclosed in []
+	    // mark the second address for dereferencing
+	    parsed.deref_2 = 1;
+
+	    char *addr_contained = malloc(len - 1);
+	    strncpy(addr_contained, second + 1, len - 2); // get the number without the square brackets
+	    addr_contained[len - 2] = '\0';
+
+	    if (is_variable_name(addr_contained)) parsed.var_2 = addr_contained;
+	    else parsed.a2 = strtoul(addr_contained, NULL, 0);
+	} else if (is_variable_name(second)) { // for a variable (or its address, with &)
+	    parsed.var_2 = strdup(second[0] == '&' ? second + 1 : second);
+	} else if (is_float_literal(second)) { // for float data (like 1.5, -2e10)
+	    parsed.a2 = float_bits(strtod(second, NULL));
+	    parsed.data_type = T_FLOAT;
+	} else if (second[0] == '-') { // for negative int data
+	    parsed.a2 = (DWORD)strtol(second, NULL, 0);
+	    parsed.data_type = T_INT;
+	} else if (len > 0) { // for unsigned int data (hex / oct / dec)
+	    parsed.a2 = strtoul(second, NULL, 0);
+	}
+
+	add_asm_line(parsed);
+    }
+
+    source_lines = line_num;
+    fclose(tasm_file);
+}
+
+// load the parsed lines onto the tape
+void emit_tasm()
+{
+    // (if a label is used before it is defined, the program is laid out twice: first to find
+    // the addresses of the labels, then to load it with them)
+    for (int pass = forward_labels ? 0 : 1; pass < 2; pass++) {
+	_ptr.pos = _MAIN;
+
+	for (int i = 0; i < asm_count; i++) {
+	    ASM_LINE *line = &asm_lines[i];
+
+	    // for label definitions (and removed lines)
+	    if (line->ins[0] == '\0') {
+		if (line->label != NULL) map_insert(label_to_address_map, line->label, _ptr.pos);
+		continue;
+	    }
+
+	    // check for instruction memory overflow
+	    if (_ptr.pos > code_end) {
+		fprintf(stderr, "ERROR: Memory overflow occurred [Line %d]. Instruction memory limit exceeded.", line->line_num);
+		if (memdump) generate_memory_dump();
+		exit(1);
+	    }
+
+	    DWORD ins_start = _ptr.pos;
+	    DWORD a1 = line->a1;
+
+	    if (line->label != NULL) {
+		DWORD *retrieved_addr = map_get(label_to_address_map, line->label);
+		if (retrieved_addr == NULL) {
+		    fprintf(stderr, "ERROR: Undefined label encountered [Line %d]", line->line_num);
+		    exit(1);
+		}
+		a1 = *retrieved_addr;
+	    }
+
+	    load_instruction(line->ins, a1, line->a2, line->data_type, line->deref_1, line->deref_2);
+	    if (pass == 1) mark_source_line(ins_start, line->line_num);
+	}
+    }
+
+    if (_ptr.pos > code_end) {
+	fprintf(stderr, "ERROR: Memory overflow occurred [Line %lu]. Instruction memory limit exceeded.", source_lines);
+	if (memdump) generate_memory_dump();
+	exit(1);
+    }
+}
+
+/*
+OPTIMIZER
+*********
+
+With the "-O" flag, the parsed program is simplified before it is emitted, using the cells
+that provably hold a constant. A storage cell is taken to be constant if every write to it
+is a "put" of the same number, in the straight-line code that "main" starts with (so it is set
+before any other code runs), and no write through a pointer can reach it. _DISP and _STK can
+be written through while they hold addresses outside storage, and any other pointer as long
+as it is only ever set by puts (like "put ptr &name"), so that all its targets are known.
+
+Where the second address of an instruction is such a constant:
+
+    mul <X> <C>, div <X> <C>       by a power of 2, become lsh / rsh (shifts are much cheaper)
+    add, sub, or, xor, lsh, rsh    by 0, and mul / div by 1, are removed
+    add / sub chains on one cell   are folded into a single add of their sum
+
+The amounts that the rewritten instructions need are kept in a pool of constant cells at the
+end of instruction memory (growing downwards from _END). Every rewrite is reported on stderr.
+
+Programs that use instruction addresses directly (rather than through labels) are left as
+they are, since the optimizer moves code around.
+*/
+
+static DWORD pool_next = _END; // next free cell of the constant pool
+
+// get a cell of the constant pool holding the value
+DWORD pool_cell(DWORD value)
+{
+    for (DWORD addr = _END; addr > pool_next; addr--) {
+	if (tape[addr].data == value) return addr;
+    }
+
+    tape[pool_next].ins = I_NONE;
+    tape[pool_next].data = value;
+    tape[pool_next].dtype = 0;
+    code_end = pool_next - 1;
+    return pool_next--;
+}
+
+void remove_line(ASM_LINE *line)
+{
+    line->ins[0] = '\0';
+    line->label = NULL;
+}
+
+static DWORD *const_value = NULL; // value of every constant storage cell
+static int *const_first_put = NULL; // line of the first put to every storage cell (0 if none, -1 if not constant)
+static BYTE *const_aliased = NULL; // whether a storage cell can be written through a pointer
+static int main_line = -1, entry_end = -1; // the straight-line code at "main" (between these lines)
+
+// whether a cell is known to hold a constant at a line
+int is_constant_at(DWORD c, int i)
+{
+    return is_storage(c) && const_first_put[c] > 0 && !(i > main_line && i < entry_end && i < const_first_put[c]);
+}
+
+// returns 0 if the program uses instruction addresses directly
+int check_addresses()
+{
+    for (int i = 0; i < asm_count; i++) {
+	ASM_LINE *line = &asm_lines[i];
+	if (line->ins[0] == '\0') continue;
+
+	int uses_address = (line->label == NULL && line->a1 >= _MAIN) ||
+	    (reads_second(line->ins) && line->a2 >= _MAIN) ||
+	    (strcmp(line->ins, "put") == 0 && line->data_type == 0 && line->a2 >= _MAIN && line->a2 <= _END);
+	int takes_label = is_jump(line->ins) || strcmp(line->ins, "cocreate") == 0;
+	if ((takes_label && line->label == NULL) || (!takes_label && line->label != NULL) || uses_address) {
+	    fprintf(stderr, "WARNING: Not optimizing, as an instruction address is used directly [Line %d]\n", line->line_num);
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+// find the constant cells (returns 0 if a write through a pointer could reach any cell)
+int find_constants()
+{
+    main_line = -1;
+    for (int i = 0; i < asm_count; i++) {
+	if (asm_lines[i].ins[0] == '\0' && asm_lines[i].label != NULL && strcmp(asm_lines[i].label, "main") == 0) main_line = i;
+    }
+    if (main_line < 0) return 0;
+
+    for (entry_end = main_line + 1; entry_end < asm_count; entry_end++) {
+	const char *ins = asm_lines[entry_end].ins;
+	if (ins[0] == '\0' || is_jump(ins) || is_switch(ins) || strcmp(ins, "ret") == 0 || strcmp(ins, "hlt") == 0) break;
+    }
+
+    if (const_value == NULL) {
+	const_value = malloc(sizeof(DWORD) * STORE_SIZE);
+	const_first_put = malloc(sizeof(int) * STORE_SIZE);
+	const_aliased = malloc(STORE_SIZE);
+    }
+    for (int i = 0; i < STORE_SIZE; i++) const_first_put[i] = 0;
+    memset(const_aliased, 0, STORE_SIZE);
+
+    int pointer_writes = 0, unsafe_pointers = 0;
+
+    for (int i = 0; i < asm_count; i++) {
+	ASM_LINE *line = &asm_lines[i];
+	if (!writes_first(line->ins)) continue;
+
+	if (line->deref_1) {
+	    if (line->a1 == _DISP || line->a1 == _STK) pointer_writes = 1;
+	    continue;
+	}
+
+	int is_put = strcmp(line->ins, "put") == 0 && !line->deref_2 && line->data_type == 0;
+
+	// (_DISP and _STK can only be written through while they point outside storage)
+	if ((line->a1 == _DISP || line->a1 == _STK) && !(is_put && line->a2 >= _STACK_END)) unsafe_pointers = 1;
+	if (!is_storage(line->a1) || const_first_put[line->a1] < 0) continue;
+
+	if (is_put && i > main_line && i < entry_end && (const_first_put[line->a1] == 0 || const_value[line->a1] == line->a2)) {
+	    if (const_first_put[line->a1] == 0) const_first_put[line->a1] = i;
+	    const_value[line->a1] = line->a2;
+	} else const_first_put[line->a1] = -1;
+    }
+    if (pointer_writes && unsafe_pointers) return 0;
+
+    // other pointers can be written through too, if every value they can hold is known (they are
+    // only ever set by puts, like "put ptr &name"), and none of those values is a pointer itself
+    for (int i = 0; i < asm_count; i++) {
+	ASM_LINE *line = &asm_lines[i];
+	if (!writes_first(line->ins) || !line->deref_1 || line->a1 == _DISP || line->a1 == _STK) continue;
+
+	DWORD pointer = line->a1;
+	for (int j = 0; j <= asm_count; j++) {
+	    // (every pointer starts out as 0)
+	    DWORD target = 0;
+	    if (j < asm_count) {
+		ASM_LINE *set = &asm_lines[j];
+		if (!writes_first(set->ins) || set->a1 != pointer || set->ins[0] == '\0') continue;
+		if (set->deref_1) continue;
+		if (strcmp(set->ins, "put") != 0 || set->deref_2 || set->data_type != 0) return 0;
+		target = set->a2;
+	    }
+
+	    if (target == _DISP || target == _STK) return 0;
+	    for (int k = 0; k < asm_count; k++) {
+		if (writes_first(asm_lines[k].ins) && asm_lines[k].deref_1 && asm_lines[k].a1 == target) return 0;
+	    }
+	    if (is_storage(target)) {
+		const_first_put[target] = -1;
+		const_aliased[target] = 1;
+	    }
+	}
+    }
+    return 1;
+}
+
+// rewrite the instructions using constants
+void simplify_lines()
+{
+    for (int i = 0; i < asm_count; i++) {
+	ASM_LINE *line = &asm_lines[i];
+	if (!reads_second(line->ins) || line->deref_1 || line->deref_2) continue;
+
+	DWORD c = line->a2, x = line->a1;
+	if (!is_constant_at(c, i)) continue;
+
+	DWORD k = const_value[c];
+	int is_add = strcmp(line->ins, "add") == 0, is_sub = strcmp(line->ins, "sub") == 0;
+
+	if (is_add || is_sub) {
+	    // fold the chain of adds and subs (of constants) to the same cell
+	    DWORD sum = 0;
+	    int j = i;
+	    for (; j < asm_count; j++) {
+		ASM_LINE *next = &asm_lines[j];
+		int next_add = strcmp(next->ins, "add") == 0;
+		if ((!next_add && strcmp(next->ins, "sub") != 0) || next->deref_1 || next->deref_2 || next->a1 != x) break;
+		if (!is_constant_at(next->a2, j)) break;
+
+		sum += next_add ? const_value[next->a2] : -const_value[next->a2];
+	    }
+
+	    char lines[32];
+	    if (line->line_num == asm_lines[j - 1].line_num) snprintf(lines, sizeof(lines), "%d", line->line_num);
+	    else snprintf(lines, sizeof(lines), "%d-%d", line->line_num, asm_lines[j - 1].line_num);
+
+	    if (sum == 0 && j - i == 1) {
+		fprintf(stderr, "OPTIMIZED [Line %d]: removed %s 0x%lx 0x%lx (0x%lx is always 0)\n", line->line_num, line->ins, x, c, c);
+		remove_line(line);
+	    } else if (sum == 0) {
+		fprintf(stderr, "OPTIMIZED [Line %s]: removed %d add/sub of constants to 0x%lx (adding up to 0)\n", lines, j - i, x);
+		for (int r = i; r < j; r++) remove_line(&asm_lines[r]);
+	    } else if (j - i > 1) {
+		DWORD amount = pool_cell(sum);
+		fprintf(stderr, "OPTIMIZED [Line %s]: folded %d add/sub of constants into add 0x%lx 0x%lx (= %ld)\n",
+			lines, j - i, x, amount, (long)sum);
+		strcpy(line->ins, "add");
+		line->a2 = amount;
+		for (int r = i + 1; r < j; r++) remove_line(&asm_lines[r]);
+	    }
+	    i = j - 1;
+	    continue;
+	}
+
+	int is_mul = strcmp(line->ins, "mul") == 0, is_div = strcmp(line->ins, "div") == 0;
+
+	if (((is_mul || is_div) && k == 1) || (k == 0 && (strcmp(line->ins, "or") == 0 || strcmp(line->ins, "xor") == 0 ||
+							   strcmp(line->ins, "lsh") == 0 || strcmp(line->ins, "rsh") == 0))) {
+	    fprintf(stderr, "OPTIMIZED [Line %d]: removed %s 0x%lx 0x%lx (0x%lx is always %lu)\n", line->line_num, line->ins, x, c, c, k);
+	    remove_line(line);
+	} else if ((is_mul || is_div) && k > 1 && (k & (k - 1)) == 0) {
+	    DWORD shift = 0;
+	    while ((1UL << shift) != k) shift++;
+
+	    DWORD amount = pool_cell(shift);
+	    fprintf(stderr, "OPTIMIZED [Line %d]: %s 0x%lx 0x%lx -> %s 0x%lx 0x%lx (0x%lx is always %lu)\n",
+		    line->line_num, line->ins, x, c, is_mul ? "lsh" : "rsh", x, amount, c, k);
+	    strcpy(line->ins, is_mul ? "lsh" : "rsh");
+	    line->a2 = amount;
+	}
+    }
+}
+
+/*
+LOOP UNROLLING
+**************
+
+A loop with a counter is unrolled (under "-O") when it has one of these two shapes:
+
+    DO-WHILE:                       WHILE:
+
+    put     <I>   <INIT>            put     <I>   <INIT>
+    <L>:                            <L>:
+	    <BODY>                          cmp     <I>   <N>
+	    add     <I>   <STEP>            j<cc>   <E>
+	    cmp     <I>   <N>                   <BODY>
+	    j<cc>   <L>                     add     <I>   <STEP>
+					    jmp     <L>
+				    <E>:
+
+where the counter I is written nowhere else (and only by the put right before the loop),
+N is either a constant cell or (like I) only written by a put before the loop, STEP is a
+constant cell (which may also be subtracted, with sub), the body has no labels or
+jumps (calls are fine), and <L> is not used anywhere else. The number of iterations is then
+known when assembling.
+
+Loops of upto UNROLL_MAX_TRIPS iterations are unrolled fully: the body is repeated once per
+iteration, and the loop overhead is gone. (If the body does not read I, the increments are
+replaced by setting I to its final value once.) Longer loops are unrolled by a factor of upto
+UNROLL_FACTOR: the body is repeated that many times inside the loop, and the iterations left
+over are peeled off in front of it. The final compare is always kept, so that _ZF and _CF
+end up as they would have been. A body that calls (or switches to a coroutine) keeps the
+compare after every step instead, as the callee might read the flags it sets. A loop is not
+allowed to grow by more than UNROLL_MAX_CELLS cells (or past the end of instruction memory).
+The copies keep their source lines.
+*/
+
+#define UNROLL_MAX_TRIPS 64
+#define UNROLL_FACTOR 8
+#define UNROLL_MAX_CELLS 1024
+#define UNROLL_MAX_SIMULATED (1UL << 24) // loops with more iterations are left alone
+
+// number of cells a line is emitted into (see load_instruction())
+DWORD line_cells(const ASM_LINE *line)
+{
+    if (line->ins[0] == '\0') return 0;
+
+    DWORD cells = 2 * (line->deref_1 + line->deref_2);
+    if (strcmp(line->ins, "put") == 0 || strcmp(line->ins, "sub") == 0 || strcmp(line->ins, "cocreate") == 0 ||
+	strcmp(line->ins, "outraw") == 0) return cells + 3;
+    if (reads_second(line->ins) || strcmp(line->ins, "cmp") == 0 || strcmp(line->ins, "fcmp") == 0 ||
+	strcmp(line->ins, "icmp") == 0) return cells + 2;
+    return cells + 1;
+}
+
+int jump_taken(const char *ins, DWORD a, DWORD b)
+{
+    if (strcmp(ins, "je") == 0) return a == b;
+    if (strcmp(ins, "jne") == 0) return a != b;
+    if (strcmp(ins, "jg") == 0) return a > b;
+    if (strcmp(ins, "jge") == 0) return a >= b;
+    if (strcmp(ins, "jl") == 0) return a < b;
+    if (strcmp(ins, "jle") == 0) return a <= b;
+    return -1;
+}
+
+const char *inverse_jump(const char *ins)
+{
+    static const char *pairs[][2] = { { "je", "jne" }, { "jg", "jle" }, { "jge", "jl" } };
+    for (int i = 0; i < 3; i++) {
+	if (strcmp(ins, pairs[i][0]) == 0) return pairs[i][1];
+	if (strcmp(ins, pairs[i][1]) == 0) return pairs[i][0];
+    }
+    return NULL;
+}
+
+typedef struct {
+    int body_start, body_end; // lines of the body (body_end excluded)
+    int last;                 // last line of the loop
+    const ASM_LINE *step;     // the add / sub of the counter
+    const ASM_LINE *cmp;      // the compare of the counter
+    const char *jump;         // the jump that continues the loop (do-while shape)
+    DWORD trips;              // number of iterations
+    DWORD final;              // value of the counter after the loop
+    int reads_counter;        // whether the body (might) read the counter
+    int calls_out;            // whether the body calls or switches out (to code that might read the flags)
+    int is_while;
+} LOOP;
+
+int is_counter_step(const ASM_LINE *line, DWORD counter, int i)
+{
+    return (strcmp(line->ins, "add") == 0 || strcmp(line->ins, "sub") == 0) && !line->deref_1 && !line->deref_2 &&
+	line->a1 == counter && is_constant_at(line->a2, i);
+}
+
+// check if the label defined at line l starts a loop that can be unrolled
+int find_loop(int l, LOOP *loop)
+{
+    const char *name = asm_lines[l].label;
+    if (name == NULL || asm_lines[l].ins[0] != '\0' || strcmp(name, "main") == 0) return 0;
+
+    // the only jump to the label must be the one that closes the loop
+    int back = -1;
+    for (int i = 0; i < asm_count; i++) {
+	if (asm_lines[i].ins[0] == '\0' || asm_lines[i].label == NULL || strcmp(asm_lines[i].label, name) != 0) continue;
+	if (back >= 0 || i < l) return 0;
+	back = i;
+    }
+    if (back < l + 3) return 0;
+
+    const ASM_LINE *first = &asm_lines[l + 1], *second = &asm_lines[l + 2], *last = &asm_lines[back];
+    int is_while = loop->is_while = strcmp(last->ins, "jmp") == 0;
+
+    if (is_while) {
+	// cmp, exit jump, body, step, jmp (and the exit label right after)
+	if (back + 1 >= asm_count || strcmp(first->ins, "cmp") != 0 || jump_taken(second->ins, 0, 0) < 0) return 0;
+	const ASM_LINE *exit = &asm_lines[back + 1];
+	if (exit->ins[0] != '\0' || exit->label == NULL || strcmp(exit->label, second->label) != 0) return 0;
+
+	loop->cmp = first;
+	loop->step = &asm_lines[back - 1];
+	loop->jump = inverse_jump(second->ins);
+	loop->body_start = l + 3;
+	loop->body_end = back - 1;
+    } else {
+	// body, step, cmp, jump
+	if (jump_taken(last->ins, 0, 0) < 0 || strcmp(asm_lines[back - 1].ins, "cmp") != 0) return 0;
+
+	loop->cmp = &asm_lines[back - 1];
+	loop->step = &asm_lines[back - 2];
+	loop->jump = last->ins;
+	loop->body_start = l + 1;
+	loop->body_end = back - 2;
+    }
+    loop->last = back;
+
+    DWORD counter = loop->cmp->a1, limit = loop->cmp->a2;
+    if (loop->cmp->deref_1 || loop->cmp->deref_2 || !is_storage(counter) || !is_storage(limit) || counter == limit) return 0;
+    if (const_aliased[counter] || const_aliased[limit]) return 0;
+    if (!is_counter_step(loop->step, counter, l)) return 0;
+
+    // the counter is only written by the put before the loop (and the step), and the limit is
+    // either a constant, or only written by a put before the loop
+    int init = -1, limit_put = -1, counter_writes = 0, limit_writes = 0;
+    for (int i = 0; i < asm_count; i++) {
+	if (!writes_first(asm_lines[i].ins) || asm_lines[i].deref_1) continue;
+	if (asm_lines[i].a1 == counter) counter_writes++;
+	if (asm_lines[i].a1 == limit) limit_writes++;
+    }
+    for (int i = l - 1; i >= 0; i--) {
+	const ASM_LINE *line = &asm_lines[i];
+	if (line->ins[0] == '\0' || is_jump(line->ins) || is_switch(line->ins) || strcmp(line->ins, "ret") == 0 || strcmp(line->ins, "hlt") == 0) break;
+	if (!writes_first(line->ins) || line->deref_1 || (line->a1 != counter && line->a1 != limit)) continue;
+
+	if (strcmp(line->ins, "put") != 0 || line->deref_2 || line->data_type != 0) return 0;
+	if (line->a1 == counter && init < 0) init = i;
+	if (line->a1 == limit && limit_put < 0) limit_put = i;
+    }
+    if (init < 0 || counter_writes != 2) return 0;
+    if (!is_constant_at(limit, l) && (limit_put < 0 || limit_writes != 1)) return 0;
+
+    // the body must be straight-line code
+    loop->reads_counter = loop->calls_out = 0;
+    for (int i = loop->body_start; i < loop->body_end; i++) {
+	const ASM_LINE *line = &asm_lines[i];
+	if (line->ins[0] == '\0' || (is_jump(line->ins) && strcmp(line->ins, "call") != 0) ||
+	    strcmp(line->ins, "ret") == 0 || strcmp(line->ins, "hlt") == 0) return 0;
+
+	if (strcmp(line->ins, "call") == 0 || is_switch(line->ins)) loop->calls_out = 1;
+	if (loop->calls_out || (line->label == NULL && line->a1 == counter) ||
+	    (line->a2 == counter && !(strcmp(line->ins, "put") == 0 && !line->deref_2))) loop->reads_counter = 1;
+    }
+
+    // count the iterations
+    DWORD i = asm_lines[init].a2, step = const_value[loop->step->a2];
+    DWORD n = is_constant_at(limit, l) ? const_value[limit] : asm_lines[limit_put].a2;
+    int is_add = strcmp(loop->step->ins, "add") == 0;
+    loop->trips = 0;
+
+    while (1) {
+	if (is_while && jump_taken(second->ins, i, n)) break;
+
+	loop->trips++;
+	i = is_add ? i + step : i - step;
+	if (loop->trips > UNROLL_MAX_SIMULATED) return 0;
+
+	if (!is_while && !jump_taken(last->ins, i, n)) break;
+    }
+    loop->final = i;
+    return 1;
+}
+
+static ASM_LINE *unrolled = NULL; // the lines of the unrolled program
+static int unrolled_count = 0, unrolled_capacity = 0;
+
+void add_unrolled_line(ASM_LINE line)
+{
+    append_line(&unrolled, &unrolled_count, &unrolled_capacity, line);
+}
+
+// copy the body (and step) of a loop, once
+// (and the compare after the step, if the body calls out)
+void add_iteration(const LOOP *loop, int with_step)
+{
+    for (int i = loop->body_start; i < loop->body_end; i++) add_unrolled_line(asm_lines[i]);
+    if (with_step) add_unrolled_line(*loop->step);
+    if (with_step && loop->calls_out) add_unrolled_line(*loop->cmp);
+}
+
+void unroll_loops()
+{
+    DWORD cells = 0;
+    for (int i = 0; i < asm_count; i++) cells += line_cells(&asm_lines[i]);
+
+    for (int l = 0; l < asm_count; l++) {
+	LOOP loop;
+	if (!find_loop(l, &loop)) {
+	    add_unrolled_line(asm_lines[l]);
+	    continue;
+	}
+
+	DWORD body_cells = line_cells(loop.step) + (loop.calls_out ? line_cells(loop.cmp) : 0);
+	for (int i = loop.body_start; i < loop.body_end; i++) body_cells += line_cells(&asm_lines[i]);
+	DWORD loop_cells = body_cells + line_cells(loop.cmp) + 1 + loop.is_while; // (the cells it has now)
+	DWORD space = code_end - _MAIN + 1 - cells;
+	if (space > UNROLL_MAX_CELLS) space = UNROLL_MAX_CELLS;
+
+	int factor;
+	if (loop.trips <= UNROLL_MAX_TRIPS && loop.trips * body_cells + line_cells(loop.cmp) + 2 <= loop_cells + space) {
+	    factor = 0; // fully
+	} else {
+	    for (factor = UNROLL_FACTOR; factor > 1; factor--) {
+		DWORD grown = (2 * factor - 1) * body_cells + line_cells(loop.cmp) + 1;
+		if (loop.trips >= (DWORD)factor && grown <= loop_cells + space) break;
+	    }
+	}
+	if (factor == 1) {
+	    add_unrolled_line(asm_lines[l]);
+	    continue;
+	}
+
+	int first_line = asm_lines[l + 1].line_num, last_line = asm_lines[loop.last].line_num;
+	int before = unrolled_count;
+
+	if (factor == 0) {
+	    fprintf(stderr, "OPTIMIZED [Line %d-%d]: unrolled the loop at \"%s\" fully (%lu iterations)\n",
+		    first_line, last_line, asm_lines[l].label, loop.trips);
+
+	    add_unrolled_line(asm_lines[l]);
+	    if (loop.calls_out && loop.is_while) add_unrolled_line(*loop.cmp);
+	    for (DWORD t = 0; t < loop.trips; t++) add_iteration(&loop, loop.reads_counter);
+
+	    if (!loop.reads_counter && loop.trips > 0) {
+		// set the counter to its final value at once
+		ASM_LINE set = *loop.step;
+		strcpy(set.ins, "mov");
+		set.a2 = pool_cell(loop.final);
+		add_unrolled_line(set);
+	    }
+	    if (!loop.calls_out) add_unrolled_line(*loop.cmp);
+	} else {
+	    fprintf(stderr, "OPTIMIZED [Line %d-%d]: unrolled the loop at \"%s\" by %d (%lu iterations)\n",
+		    first_line, last_line, asm_lines[l].label, factor, loop.trips);
+
+	    if (loop.calls_out && loop.is_while) add_unrolled_line(*loop.cmp);
+	    for (DWORD t = 0; t < loop.trips % factor; t++) add_iteration(&loop, 1);
+	    add_unrolled_line(asm_lines[l]);
+	    for (int t = 0; t < factor; t++) add_iteration(&loop, 1);
+	    if (!loop.calls_out) add_unrolled_line(*loop.cmp);
+
+	    ASM_LINE jump = asm_lines[loop.last];
+	    strcpy(jump.ins, loop.jump);
+	    jump.label = asm_lines[l].label;
+	    add_unrolled_line(jump);
+	}
+
+	for (int i = before; i < unrolled_count; i++) cells += line_cells(&unrolled[i]);
+	cells -= loop_cells;
+	l = loop.last;
+    }
+
+    free(asm_lines);
+    asm_lines = unrolled;
+    asm_count = unrolled_count;
+    asm_capacity = unrolled_capacity;
+    unrolled = NULL;
+    unrolled_count = unrolled_capacity = 0;
+}
+
+/*
+CODE FOLDING
+************
+
+Programs (generated ones in particular) often have routines that are identical but for their
+labels, and every copy takes up instruction memory. Under "-O", once the lines are final, a
+routine is taken to be the lines from a label upto the first ret, jmp, hlt or vexit, when:
+
+    (1) the label is its only one (no other label is defined inside it, or right before it)
+    (2) nothing falls through into it (the line before it is a ret, jmp, hlt or vexit)
+    (3) it is not "main"
+
+The lines of every routine are hashed, and the routines with the same hash are compared line
+by line. The comparison is relocation-aware: a jump or call to the routine's own label (like
+a loop, or recursion) matches the same in the other routine, while any other label must be
+the same one. When a routine is identical to one before it, every jump, call and cocreate
+to its label is redirected to the other one, and its lines are removed. This is repeated
+until nothing is folded, as routines that call two folded ones may now be identical too.
+Every fold is reported on stderr, with the cells saved.
+*/
+
+typedef struct {
+    int def;      // the line defining the label
+    int end;      // the line after the last one
+    DWORD hash;
+    int folded;
+} ROUTINE;
+
+int ends_routine(const char *ins)
+{
+    return strcmp(ins, "ret") == 0 || strcmp(ins, "jmp") == 0 || strcmp(ins, "hlt") == 0 || strcmp(ins, "vexit") == 0;
+}
+
+int takes_label(const char *ins)
+{
+    return is_jump(ins) || strcmp(ins, "cocreate") == 0;
+}
+
+// the line after the routine whose label is defined at line l (or -1 if it cannot be folded)
+int routine_end(int l)
+{
+    if (strcmp(asm_lines[l].label, "main") == 0) return -1;
+
+    int k = l - 1;
+    while (k >= 0 && asm_lines[k].ins[0] == '\0' && asm_lines[k].label == NULL) k--;
+    if (k >= 0 && !ends_routine(asm_lines[k].ins)) return -1;
+
+    for (int i = l + 1; i < asm_count; i++) {
+	if (asm_lines[i].ins[0] == '\0') {
+	    if (asm_lines[i].label != NULL) return -1;
+	    continue;
+	}
+	if (ends_routine(asm_lines[i].ins)) return i + 1;
+    }
+    return -1;
+}
+
+DWORD routine_hash(const ROUTINE *r)
+{
+    const char *name = asm_lines[r->def].label;
+    DWORD h = 14695981039346656037UL;
+
+    for (int i = r->def + 1; i < r->end; i++) {
+	const ASM_LINE *line = &asm_lines[i];
+	if (line->ins[0] == '\0') continue;
+
+	for (const char *c = line->ins; *c; c++) h = (h ^ (BYTE)*c) * 1099511628211UL;
+	h = (h ^ line->a1) * 1099511628211UL;
+	h = (h ^ line->a2) * 1099511628211UL;
+	h = (h ^ (line->data_type | line->deref_1 << 8 | line->deref_2 << 9)) * 1099511628211UL;
+	if (line->label != NULL && strcmp(line->label, name) != 0) {
+	    for (const char *c = line->label; *c; c++) h = (h ^ (BYTE)*c) * 1099511628211UL;
+	}
+    }
+    return h;
+}
+
+int same_routines(const ROUTINE *x, const ROUTINE *y)
+{
+    const char *x_name = asm_lines[x->def].label, *y_name = asm_lines[y->def].label;
+    int i = x->def + 1, j = y->def + 1;
+
+    while (1) {
+	while (i < x->end && asm_lines[i].ins[0] == '\0') i++;
+	while (j < y->end && asm_lines[j].ins[0] == '\0') j++;
+	if (i == x->end || j == y->end) return i == x->end && j == y->end;
+
+	const ASM_LINE *a = &asm_lines[i++], *b = &asm_lines[j++];
+	if (strcmp(a->ins, b->ins) != 0 || a->a1 != b->a1 || a->a2 != b->a2 || a->data_type != b->data_type ||
+	    a->deref_1 != b->deref_1 || a->deref_2 != b->deref_2) return 0;
+	if (a->label == NULL || b->label == NULL) {
+	    if (a->label != b->label) return 0;
+	    continue;
+	}
+
+	// (a jump to its own routine is the same in both)
+	int a_self = strcmp(a->label, x_name) == 0, b_self = strcmp(b->label, y_name) == 0;
+	if (a_self != b_self || (!a_self && strcmp(a->label, b->label) != 0)) return 0;
+    }
+}
+
+void fold_routines()
+{
+    ROUTINE *routines = NULL;
+    int folded, total_folded = 0;
+    DWORD total_cells = 0;
+
+    do {
+	folded = 0;
+
+	int count = 0;
+	for (int l = 0; l < asm_count; l++) {
+	    if (asm_lines[l].ins[0] != '\0' || asm_lines[l].label == NULL) continue;
+
+	    int end = routine_end(l);
+	    if (end < 0) continue;
+
+	    routines = realloc(routines, sizeof(ROUTINE) * (count + 1));
+	    routines[count] = (ROUTINE){ l, end, 0, 0 };
+	    routines[count].hash = routine_hash(&routines[count]);
+	    count++;
+	}
+
+	for (int r = 1; r < count; r++) {
+	    ROUTINE *copy = &routines[r], *kept = NULL;
+	    for (int k = 0; k < r && kept == NULL; k++) {
+		if (!routines[k].folded && routines[k].hash == copy->hash && same_routines(&routines[k], copy)) kept = &routines[k];
+	    }
+	    if (kept == NULL) continue;
+
+	    const char *name = asm_lines[copy->def].label, *into = asm_lines[kept->def].label;
+	    DWORD cells = 0;
+	    int first_line = asm_lines[copy->def].line_num, last_line = asm_lines[copy->end - 1].line_num;
+	    for (int i = copy->def + 1; i < copy->end; i++) cells += line_cells(&asm_lines[i]);
+
+	    fprintf(stderr, "OPTIMIZED [Line %d-%d]: folded \"%s\" into the identical \"%s\" (%lu cells saved)\n",
+		    first_line, last_line, name, into, cells);
+
+	    for (int i = 0; i < asm_count; i++) {
+		ASM_LINE *line = &asm_lines[i];
+		if (line->ins[0] != '\0' && takes_label(line->ins) && strcmp(line->label, name) == 0) line->label = (char *)into;
+	    }
+	    for (int i = copy->def; i < copy->end; i++) remove_line(&asm_lines[i]);
+
+	    copy->folded = 1;
+	    folded++;
+	    total_cells += cells;
+	}
+	total_folded += folded;
+    } while (folded > 0);
+    free(routines);
+
+    if (total_folded > 1) fprintf(stderr, "OPTIMIZED: %d identical routines folded (%lu cells saved)\n", total_folded, total_cells);
+}
+
+void optimize_tasm()
+{
+    if (!check_addresses() || !find_constants()) return;
+
+    unroll_loops();
+    find_constants(); // (the lines have moved)
+    simplify_lines();
+    fold_routines();
+}
+
+void assemble_tasm(const char *tasm_file_name)
+{
+    parse_tasm(tasm_file_name);
+    allocate_variables();
+    resolve_variables();
+    if (optimize) optimize_tasm();
+    emit_tasm();
+
+    // add halt at the end for safety
+    tape[_ptr.pos].ins = I_HALT;
+    tape[_ptr.pos].data = 0;
+
+    // set the pointer position to the main label
+    DWORD *main_addr = map_get(label_to_address_map, "main");
+    if (main_addr == NULL) {
+	fprintf(stderr, "ERROR: Could not find \"main\"");
+	exit(1);
+    }
+    _ptr.pos = *main_addr;
+
+    // set the initial addresses in the flags
+    tape[_DISP].data = _OUT;
+    tape[_STK].data = _STACK;
+}
+
+/*
+OUTPUT SINK
+***********
+
+Everything that output() prints goes through the sink, which writes to stdout by default.
+Running with "-o <FILE>" writes it into FILE instead. The file is preallocated and mapped
+into memory in chunks of SINK_CHUNK bytes, so that the output is rendered straight into
+the page cache rather than being copied through stdio and write() calls. When the machine
+exits (after halting, or on an error), the file is truncated to the length actually written.
+*/
+
+#define SINK_CHUNK (64UL << 20)
+
+static FILE *sink_file = NULL;  // (when not mapped)
+#ifdef TASM_POSIX
+static int sink_fd = -1;
+static char *sink_map = NULL;
+static DWORD sink_len = 0, sink_cap = 0;
+static pid_t sink_owner = 0;    // (forked machines must not truncate the file)
+
+void sink_close()
+{
+    if (sink_fd < 0 || getpid() != sink_owner) return;
+
+    munmap(sink_map, sink_cap);
+    if (ftruncate(sink_fd, sink_len) != 0) fprintf(stderr, "WARNING: Failed to truncate the output file\n");
+    close(sink_fd);
+    sink_fd = -1;
+}
+
+// map the next chunk of the file (at least min_cap bytes in all)
+void sink_grow(DWORD min_cap)
+{
+    DWORD cap = sink_cap;
+    while (cap < min_cap) cap += SINK_CHUNK;
+
+    if (sink_map != NULL) munmap(sink_map, sink_cap);
+
+#ifdef __linux__
+    int failed = fallocate(sink_fd, 0, 0, cap) != 0 && ftruncate(sink_fd, cap) != 0;
+#else
+    int failed = ftruncate(sink_fd, cap) != 0;
+#endif
+    sink_map = failed ? MAP_FAILED : mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED, sink_fd, 0);
+    if (sink_map == MAP_FAILED) {
+	sink_map = NULL;
+	fprintf(stderr, "RUNTIME ERROR: Failed to extend the output file");
+	if (memdump) generate_memory_dump();
+	exit(1);
+    }
+    sink_cap = cap;
+}
+#endif
+
+void sink_open(const char *file_name)
+{
+#ifdef TASM_POSIX
+    sink_fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (sink_fd < 0) {
+	fprintf(stderr, "ERROR: Failed to create the output file");
+	exit(1);
+    }
+    sink_owner = getpid();
+    sink_grow(SINK_CHUNK);
+    atexit(sink_close);
+#else
+    sink_file = fopen(file_name, "wb");
+    if (sink_file == NULL) {
+	fprintf(stderr, "ERROR: Failed to create the output file");
+	exit(1);
+    }
+#endif
+}
+
+void sink_write(const char *data, size_t len)
+{
+    output_bytes += len;
+
+#ifdef TASM_POSIX
+    if (sink_fd >= 0) {
+	if (sink_len + len > sink_cap) sink_grow(sink_len + len);
+	memcpy(sink_map + sink_len, data, len);
+	sink_len += len;
+	return;
+    }
+#endif
+    fwrite(data, 1, len, sink_file != NULL ? sink_file : stdout);
+}
+
+static inline void sink_putc(char c)
+{
+#ifdef TASM_POSIX
+    if (sink_fd >= 0 && sink_len < sink_cap) {
+	sink_map[sink_len++] = c;
+	output_bytes++;
+	return;
+    }
+#endif
+    sink_write(&c, 1);
+}
+
+// write any output buffered by stdio (before forking, or printing to the terminal)
+void sink_flush()
+{
+    fflush(sink_file != NULL ? sink_file : stdout);
+}
+
+/*
+FRAMEBUFFER
+***********
+
+Running with "-fb <W>x<H>" treats display memory as a fixed grid of W columns and H rows
+(the cell at _OUT + y * W + x is the character at column x of row y), rather than a stream
+of text. Every "out" redraws the grid in place: it is compared with the frame drawn last,
+and only the spans of characters that changed are written (each after an ANSI cursor move),
+all in a single write. Programs that redraw a screen can then rewind _DISP and update only
+what they need, without scrolling the terminal.
+
+A cell holding a printable character is shown as it is (numbers are taken as character codes),
+and every other cell is shown as a blank.
+*/
+
+#define FB_MAX_GAP 8 // unchanged characters worth rewriting, rather than moving the cursor past them
+
+static DWORD fb_width = 0, fb_height = 0;
+static char *fb_shown = NULL; // the frame drawn last
+static char *fb_batch = NULL; // the escape sequences and characters of one "out"
+
+// move the cursor below the frame, so that the shell prompt does not overwrite it
+void fb_close()
+{
+    char move[32];
+    sink_write(move, sprintf(move, "\033[%lu;1H", fb_height + 1));
+    sink_flush();
+}
+
+void fb_open(const char *size)
+{
+    if (sscanf(size, "%lux%lu", &fb_width, &fb_height) != 2 || fb_width == 0 || fb_height == 0 || fb_width * fb_height > DISPLAY_SIZE) {
+	fprintf(stderr, "ERROR: Invalid framebuffer size \"%s\" (expected <W>x<H>, within the display memory)", size);
+	exit(1);
+    }
+
+    fb_shown = malloc(fb_width * fb_height);
+    memset(fb_shown, ' ', fb_width * fb_height);
+    fb_batch = malloc(fb_width * fb_height * 2 + fb_height * 16 + 16);
+
+    // start from a blank screen
+    sink_write("\033[H\033[2J", 7);
+    atexit(fb_close);
+}
+
+char fb_char(DWORD addr)
+{
+    DWORD val = tape[addr].data;
+    return (val >= ' ' && val <= '~') ? (char)val : ' ';
+}
+
+void fb_output()
+{
+    size_t len = 0;
+
+    for (DWORD y = 0; y < fb_height; y++) {
+	char *shown = fb_shown + y * fb_width;
+	DWORD row = _OUT + y * fb_width;
+	DWORD x = 0;
+
+	while (x < fb_width) {
+	    if (fb_char(row + x) == shown[x]) {
+		x++;
+		continue;
+	    }
+
+	    // extend the span over short runs of unchanged characters
+	    DWORD end = x + 1, last_changed = x;
+	    while (end < fb_width && end - last_changed <= FB_MAX_GAP) {
+		if (fb_char(row + end) != shown[end]) last_changed = end;
+		end++;
+	    }
+
+	    len += sprintf(fb_batch + len, "\033[%lu;%luH", y + 1, x + 1);
+	    for (; x <= last_changed; x++) {
+		shown[x] = fb_char(row + x);
+		fb_batch[len++] = shown[x];
+	    }
+	}
+    }
+    if (len == 0) return;
+
+    sink_flush();
+    sink_write(fb_batch, len);
+    sink_flush();
+}
+
+// output display text
+void output()
+{
+    DWORD final_addr = _ptr.pos + 1;
+    if (steps < output_shown_until) {
+	_ptr.pos = final_addr;
+	return;
+    }
+
+    if (fb_width) {
+	fb_output();
+	_ptr.pos = final_addr;
+	return;
+    }
+
+    _ptr.pos = _OUT;
+
+    while (_ptr.pos < _OUT_END && _ptr.pos < tape[_DISP].data) {
+	DWORD val = tape[_ptr.pos].data;
+
+	// if dtype is 1, treat like a char (escapes were decoded by the assembler)
+	if (tape[_ptr.pos].dtype == T_CHAR) {
+	    sink_putc((char) (val & 0xFF));
+	} else if (tape[_ptr.pos].dtype == T_FLOAT) {
+	    char number[32];
+	    sink_write(number, snprintf(number, sizeof(number), "%g", as_float(val)));
+	} else if (tape[_ptr.pos].dtype == T_INT) {
+	    char number[24];
+	    sink_write(number, sprintf(number, "%ld", (long)val));
+	} else {
+	    char number[24];
+	    sink_write(number, sprintf(number, "%lu", val));
+	}
+
+	_ptr.pos++;
+    }
+    _ptr.pos = final_addr;
+}
+
+/*
+RAW OUTPUT
+**********
+
+"outraw <ADDR> <COUNT> <FORMAT>" writes the data of COUNT cells from ADDR to the sink as
+binary, with no formatting at all, so that a program can feed numbers to another one
+without them being printed and parsed back. The formats are:
+
+    u8     the lowest byte of every cell
+    u32    the lowest 4 bytes of every cell, little-endian
+    u64    all 8 bytes of every cell, little-endian (a T_FLOAT gives the bits of its double)
+
+The assembler packs the count and format into the value of the instruction (count << 2 | format).
+*/
+
+#define RAW_BATCH 8192 // bytes written to the sink at once
+
+void output_raw(DWORD base, DWORD count, int format)
+{
+    if (base > _END || count > _END - base + 1) {
+	fprintf(stderr, "RUNTIME ERROR: Memory out of bounds. outraw of %lu cells from 0x%lx goes past the end of the tape", count, base);
+	if (memdump) generate_memory_dump();
+	exit(1);
+    }
+    if (steps < output_shown_until) return;
+
+    BYTE batch[RAW_BATCH];
+    int width = format == RAW_U8 ? 1 : format == RAW_U32 ? 4 : 8;
+    DWORD len = 0;
+
+    for (DWORD i = 0; i < count; i++) {
+	DWORD value = tape[base + i].data;
+	for (int b = 0; b < width; b++) batch[len++] = (BYTE)(value >> (8 * b));
+
+	if (len + 8 > RAW_BATCH) {
+	    sink_write((const char *)batch, len);
+	    len = 0;
+	}
+    }
+    if (len > 0) sink_write((const char *)batch, len);
+}
+
+/*
+LIVE STATISTICS
+***************
+
+The machine reaches a "safe point" once every SAFE_POINT_INTERVAL steps. At a safe
+point, the state of the tape is consistent (no instruction is halfway done), and
+run() publishes its statistics into shared memory (see tasm_stats.h) so that
+tasm-top can display them.
+
+(Safe points can be made more frequent with "-state-every", for state traces)
+*/
+
+#define SAFE_POINT_INTERVAL (1UL << 20)
+
+static DWORD safe_point_mask = SAFE_POINT_INTERVAL - 1;
+
+static TASM_STATS *stats = NULL;
+static char stats_name[32];
+static DWORD stats_last_steps = 0;
+static DWORD stats_last_ns = 0;
+
+// current time in nanoseconds (monotonic)
+DWORD now_ns()
+{
+    struct timespec ts;
+#ifdef TASM_POSIX
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (DWORD)ts.tv_sec * 1000000000UL + (DWORD)ts.tv_nsec;
+}
+
+// cpu timestamp counter (falls back to the monotonic clock where there is none)
+DWORD read_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return (DWORD)__rdtsc();
+#elif defined(__aarch64__)
+    DWORD ticks;
+    __asm__ volatile ("mrs %0, cntvct_el0" : "=r" (ticks));
+    return ticks;
+#else
+    return now_ns();
+#endif
+}
+
+// remove the statistics segment of this machine
+void stats_close()
+{
+#ifdef TASM_POSIX
+    if (stats == NULL) return;
+
+    munmap(stats, sizeof(TASM_STATS));
+    shm_unlink(stats_name);
+    stats = NULL;
+#endif
+}
+
+// create the shared memory segment for the statistics of this machine
+// (failing to do so is not an error, the machine simply runs without it)
+void stats_open(const char *program_name)
+{
+#ifdef TASM_POSIX
+    snprintf(stats_name, sizeof(stats_name), "/" TASM_STATS_PREFIX "%ld", (long)getpid());
+
+    int fd = shm_open(stats_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) return;
+
+    if (ftruncate(fd, sizeof(TASM_STATS)) != 0) {
+	close(fd);
+	shm_unlink(stats_name);
+	return;
+    }
+
+    void *block = mmap(NULL, sizeof(TASM_STATS), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (block == MAP_FAILED) {
+	shm_unlink(stats_name);
+	return;
+    }
+
+    stats = block;
+    stats->pid = (unsigned long)getpid();
+    strncpy(stats->program, program_name, TASM_STATS_NAME_LEN - 1);
+    stats->magic = TASM_STATS_MAGIC;
+
+    stats_last_ns = now_ns();
+    atexit(stats_close);
+#endif
+}
+
+// write the current machine state into the statistics segment
+void stats_publish()
+{
+    if (stats == NULL) return;
+
+    DWORD now = now_ns();
+    DWORD elapsed = now - stats_last_ns;
+    const char *label = map_find_enclosing(label_to_address_map, _ptr.pos);
+
+    stats->seq++;
+    __sync_synchronize();
+
+    stats->steps = steps;
+    stats->pos = _ptr.pos;
+    stats->stack_depth = stack_start_of(tape) - tape[_STK].data;
+    stats->display_fill = tape[_DISP].data - _OUT;
+    if (elapsed > 0) stats->steps_per_sec = (DWORD)((double)(steps - stats_last_steps) * 1e9 / elapsed);
+    strncpy(stats->label, label ? label : "", TASM_STATS_NAME_LEN - 1);
+
+    __sync_synchronize();
+    stats->seq++;
+
+    stats_last_steps = steps;
+    stats_last_ns = now;
+}
+
+// print the current position and every call site on the stack (most recent first)
+void print_stack_trace(FILE *file)
+{
+    DWORD call_site = _ptr.pos;
+
+    for (DWORD addr = tape[_STK].data; addr <= stack_start_of(tape); addr++) {
+	if (addr > tape[_STK].data) call_site = tape[addr].data - 1;
+
+	const char *label = map_find_enclosing(label_to_address_map, call_site);
+	int line = (call_site >= _MAIN && call_site <= _END) ? source_line[call_site - _MAIN] : 0;
+	fprintf(file, "    #%lu  0x%08lx  %s", addr - tape[_STK].data, call_site, label ? label : "?");
+	if (line) fprintf(file, "  [Line %d]", line);
+	fprintf(file, "\n");
+    }
+}
+
+/*
+ON-DEMAND SNAPSHOTS
+*******************
+
+Sending SIGUSR1 to a running machine requests a snapshot of its state. The signal
+handler only sets a flag, and at the next safe point run() forks: the child writes
+the memory dump files (with a ".<PID>.<N>" suffix) along with a snapshot file that
+holds the current position, its label and the call stack, while the parent simply
+continues executing. Only one snapshot is written at a time.
+*/
+
+#ifdef TASM_POSIX
+static volatile sig_atomic_t snapshot_requested = 0;
+static pid_t snapshot_pid = 0;  // child currently writing a snapshot
+static int snapshot_count = 0;
+
+void request_snapshot(int sig)
+{
+    (void)sig;
+    snapshot_requested = 1;
+}
+
+// write the position, label and call stack of the machine into a file
+void write_stack_trace(const char *file_name)
+{
+    FILE *file = fopen(file_name, "w");
+    if (file == NULL) return;
+
+    const char *label = map_find_enclosing(label_to_address_map, _ptr.pos);
+    fprintf(file, "steps: %lu\n", steps);
+    fprintf(file, "position: 0x%08lx (%s)\n", _ptr.pos, label ? label : "?");
+    fprintf(file, "stack trace:\n");
+    print_stack_trace(file);
+    fclose(file);
+}
+
+void take_snapshot()
+{
+    // let the previous snapshot finish first
+    if (snapshot_pid > 0) {
+	if (waitpid(snapshot_pid, NULL, WNOHANG) == 0) return;
+	snapshot_pid = 0;
+    }
+    snapshot_requested = 0;
+    snapshot_count++;
+
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".%ld.%d", (long)getpid(), snapshot_count);
+
+    fflush(stdout);
+    sink_flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+	fprintf(stderr, "WARNING: Failed to take snapshot (fork failed)\n");
+	return;
+    }
+
+    if (pid == 0) {
+	char file_name[128];
+	snprintf(file_name, sizeof(file_name), "__SNAPSHOT%s.tasm.txt", suffix);
+
+	write_stack_trace(file_name);
+	write_memory_dump(suffix);
+	_exit(0); // skip the exit handlers of the parent
+    }
+
+    snapshot_pid = pid;
+    fprintf(stderr, "SNAPSHOT: Writing snapshot %s at step %lu\n", suffix + 1, steps);
+}
+#endif
+
+/*
+RECORD AND REPLAY
+*****************
+
+The only nondeterministic inputs of a program are the values read by clk and tsc.
+Running with "-record <LOG>" appends every such value (with the step it was read at)
+to the log, along with a checkpoint of the machine every RECORD_CHECKPOINT_INTERVAL
+steps. Running with "-replay <LOG>" feeds the logged values back in place of the real
+clock, so the program executes exactly as it did when it was recorded.
+
+A checkpoint stores the tape pointer, the position in the input log, and every
+non-empty cell of the tape (as runs of consecutive cells), so it stays small for
+most programs. Under the debugger, checkpoints are also kept in memory (every
+SAFE_POINT_INTERVAL steps to begin with, and thinned out as they pile up). The
+debugger travels back to any step by restoring the closest checkpoint before it,
+and re-executing forward with the logged inputs (and the output muted).
+
+LOG FORMAT:
+
+    "TASMLOG1" <HASH OF INSTRUCTION MEMORY>
+    'I' <STEP> <VALUE>                                              (an input)
+    'K' <STEP> <INPUT CURSOR> <TAPE_PTR> <SIZE> <SIZE BYTES OF RUNS>  (a checkpoint)
+
+    where each run is <START> <COUNT> <COUNT BLOCKS>
+*/
+
+#define LOG_MAGIC "TASMLOG1"
+#define RECORD_CHECKPOINT_INTERVAL (1UL << 26)
+#define MAX_CHECKPOINTS 64
+
+typedef struct {
+    DWORD step;
+    DWORD value;
+} INPUT;
+
+typedef struct {
+    DWORD steps;
+    DWORD input_cursor;
+    TAPE_PTR ptr;
+    DWORD size;
+    BYTE *runs;
+} CHECKPOINT;
+
+static INPUT *inputs = NULL;   // inputs read so far (or loaded from the replay log)
+static DWORD input_count = 0;
+static DWORD input_capacity = 0;
+static DWORD input_cursor = 0; // next input to be read
+static int keep_inputs = 0;    // whether inputs are kept in memory (for time travel)
+static int replaying = 0;
+static FILE *record_file = NULL;
+
+static CHECKPOINT checkpoints[MAX_CHECKPOINTS];
+static int checkpoint_count = 0;
+static int keep_checkpoints = 0;
+static DWORD checkpoint_interval = SAFE_POINT_INTERVAL;
+static DWORD checkpoint_next = 0; // (steps re-executed by the debugger are not checkpointed again)
+
+void disarm_breakpoints();
+void arm_breakpoints();
+void unprotect_watched_pages();
+void protect_watched_pages();
+void compress_epoch();
+void reload_arm();
+
+// hash of the instruction memory (to check that a log belongs to the program)
+DWORD program_hash()
+{
+    DWORD h = 14695981039346656037UL;
+    for (DWORD i = _MAIN; i <= _END; i++) {
+	h = (h ^ tape[i].ins) * 1099511628211UL;
+	h = (h ^ tape[i].data) * 1099511628211UL;
+    }
+    return h;
+}
+
+void keep_input(DWORD step, DWORD value)
+{
+    if (input_count == input_capacity) {
+	input_capacity = input_capacity ? input_capacity * 2 : 1024;
+	inputs = realloc(inputs, input_capacity * sizeof(INPUT));
+    }
+    inputs[input_count].step = step;
+    inputs[input_count].value = value;
+    input_count++;
+}
+
+// read a nondeterministic input (from the log if it was already read once)
+DWORD read_input(INSTRUCTION source)
+{
+    DWORD value;
+
+    if (input_cursor < input_count) {
+	if (inputs[input_cursor].step != steps) {
+	    fprintf(stderr, "RUNTIME ERROR: Replay diverged from the log at step %lu", steps);
+	    exit(1);
+	}
+	value = inputs[input_cursor].value;
+    } else {
+	if (replaying) {
+	    fprintf(stderr, "RUNTIME ERROR: Replay log exhausted at step %lu", steps);
+	    exit(1);
+	}
+	value = source == I_CLK ? now_ns() : read_tsc();
+
+	if (record_file != NULL) {
+	    fputc('I', record_file);
+	    fwrite(&steps, sizeof(DWORD), 1, record_file);
+	    fwrite(&value, sizeof(DWORD), 1, record_file);
+	}
+	if (keep_inputs) keep_input(steps, value);
+    }
+    input_cursor++;
+    return value;
+}
+
+// encode the non-empty cells of the tape as runs
+BYTE *encode_tape(DWORD *size)
+{
+    DWORD capacity = 4096, used = 0;
+    BYTE *runs = malloc(capacity);
+    DWORD total = sizeof(tape) / sizeof(BLOCK);
+
+    for (DWORD i = 0; i < total; i++) {
+	if (tape[i].ins == I_NONE && tape[i].data == 0 && tape[i].dtype == 0) continue;
+
+	DWORD start = i;
+	while (i < total && !(tape[i].ins == I_NONE && tape[i].data == 0 && tape[i].dtype == 0)) i++;
+	DWORD count = i - start;
+
+	DWORD needed = used + 2 * sizeof(DWORD) + count * sizeof(BLOCK);
+	while (needed > capacity) capacity *= 2;
+	runs = realloc(runs, capacity);
+
+	memcpy(runs + used, &start, sizeof(DWORD));
+	memcpy(runs + used + sizeof(DWORD), &count, sizeof(DWORD));
+	memcpy(runs + used + 2 * sizeof(DWORD), &tape[start], count * sizeof(BLOCK));
+	used = needed;
+    }
+    *size = used;
+    return runs;
+}
+
+void decode_tape(const BYTE *runs, DWORD size)
+{
+    memset(tape, 0, sizeof(tape));
+
+    for (DWORD used = 0; used < size;) {
+	DWORD start, count;
+	memcpy(&start, runs + used, sizeof(DWORD));
+	memcpy(&count, runs + used + sizeof(DWORD), sizeof(DWORD));
+	memcpy(&tape[start], runs + used + 2 * sizeof(DWORD), count * sizeof(BLOCK));
+	used += 2 * sizeof(DWORD) + count * sizeof(BLOCK);
+    }
+}
+
+// keep a checkpoint in memory, thinning out the older ones when there are too many
+void keep_checkpoint(CHECKPOINT checkpoint)
+{
+    if (checkpoint_count == MAX_CHECKPOINTS) {
+	// keep the first one and every other one after it, and take them half as often
+	int kept = 1;
+	for (int i = 1; i < checkpoint_count; i++) {
+	    if (i % 2 == 0) checkpoints[kept++] = checkpoints[i];
+	    else free(checkpoints[i].runs);
+	}
+	checkpoint_count = kept;
+	checkpoint_interval *= 2;
+    }
+    checkpoints[checkpoint_count++] = checkpoint;
+}
+
+// take a checkpoint of the current state (in memory and/or in the record log)
+void take_checkpoint()
+{
+    if (steps < checkpoint_next) return;
+    checkpoint_next = steps + 1;
+
+    CHECKPOINT checkpoint;
+    checkpoint.steps = steps;
+    checkpoint.input_cursor = input_cursor;
+    checkpoint.ptr = _ptr;
+
+    disarm_breakpoints();
+    checkpoint.runs = encode_tape(&checkpoint.size);
+    arm_breakpoints();
+
+    if (record_file != NULL) {
+	fputc('K', record_file);
+	fwrite(&checkpoint.steps, sizeof(DWORD), 1, record_file);
+	fwrite(&checkpoint.input_cursor, sizeof(DWORD), 1, record_file);
+	fwrite(&checkpoint.ptr, sizeof(TAPE_PTR), 1, record_file);
+	fwrite(&checkpoint.size, sizeof(DWORD), 1, record_file);
+	fwrite(checkpoint.runs, 1, checkpoint.size, record_file);
+    }
+
+    if (keep_checkpoints) keep_checkpoint(checkpoint);
+    else free(checkpoint.runs);
+}
+
+// restore the machine to the latest checkpoint at or before a step
+void restore_checkpoint(DWORD target)
+{
+    int best = 0;
+    for (int i = 0; i < checkpoint_count; i++) {
+	if (checkpoints[i].steps <= target && checkpoints[i].steps >= checkpoints[best].steps) best = i;
+    }
+
+    unprotect_watched_pages();
+    decode_tape(checkpoints[best].runs, checkpoints[best].size);
+    arm_breakpoints();
+    protect_watched_pages();
+
+    _ptr = checkpoints[best].ptr;
+    steps = checkpoints[best].steps;
+    input_cursor = checkpoints[best].input_cursor;
+    stats_last_steps = steps;
+}
+
+void stop_recording()
+{
+    if (record_file != NULL) fclose(record_file);
+    record_file = NULL;
+}
+
+void start_recording(const char *log_name)
+{
+    record_file = fopen(log_name, "wb");
+    if (record_file == NULL) {
+	fprintf(stderr, "ERROR: Failed to create the record log");
+	exit(1);
+    }
+
+    DWORD hash = program_hash();
+    fwrite(LOG_MAGIC, 1, strlen(LOG_MAGIC), record_file);
+    fwrite(&hash, sizeof(DWORD), 1, record_file);
+
+    if (!keep_checkpoints) checkpoint_interval = RECORD_CHECKPOINT_INTERVAL;
+    take_checkpoint();
+    atexit(stop_recording);
+}
+
+void start_replay(const char *log_name)
+{
+    FILE *log = fopen(log_name, "rb");
+    char magic[8];
+    DWORD hash;
+
+    if (log == NULL || fread(magic, 1, 8, log) != 8 || memcmp(magic, LOG_MAGIC, 8) != 0 || fread(&hash, sizeof(DWORD), 1, log) != 1) {
+	fprintf(stderr, "ERROR: Invalid replay log");
+	exit(1);
+    }
+    if (hash != program_hash()) {
+	fprintf(stderr, "ERROR: The replay log was recorded from a different program");
+	exit(1);
+    }
+
+    replaying = 1;
+    int type;
+    while ((type = fgetc(log)) != EOF) {
+	if (type == 'I') {
+	    INPUT input;
+	    if (fread(&input.step, sizeof(DWORD), 1, log) != 1 || fread(&input.value, sizeof(DWORD), 1, log) != 1) break;
+	    keep_input(input.step, input.value);
+	} else if (type == 'K') {
+	    CHECKPOINT checkpoint;
+	    if (fread(&checkpoint.steps, sizeof(DWORD), 1, log) != 1 ||
+		fread(&checkpoint.input_cursor, sizeof(DWORD), 1, log) != 1 ||
+		fread(&checkpoint.ptr, sizeof(TAPE_PTR), 1, log) != 1 ||
+		fread(&checkpoint.size, sizeof(DWORD), 1, log) != 1) break;
+
+	    checkpoint.runs = malloc(checkpoint.size);
+	    if (fread(checkpoint.runs, 1, checkpoint.size, log) != checkpoint.size) {
+		free(checkpoint.runs);
+		break;
+	    }
+
+	    // only kept for time travel in the debugger
+	    if (keep_checkpoints) keep_checkpoint(checkpoint);
+	    else free(checkpoint.runs);
+	} else break;
+    }
+    fclose(log);
+}
+
+/*
+STATE TRACES
+************
+
+To check that every execution engine (see run()) behaves exactly like the reference
+switch loop, "-state <FILE>" writes a hash of the whole machine state (the tape and
+the tape pointer) into FILE every N steps (set with "-state-every <N>", which must be
+a power of 2), and the final state after the program halts. The full tape at halt is
+also written in binary, into FILE.tape. tools/tasm-diff.c compares these between engines.
+*/
+
+static FILE *state_file = NULL;
+static DWORD state_every = 0;
+
+DWORD state_hash()
+{
+    DWORD h = 14695981039346656037UL;
+    for (DWORD i = 0; i < sizeof(tape) / sizeof(BLOCK); i++) {
+	h = (h ^ tape[i].ins) * 1099511628211UL;
+	h = (h ^ tape[i].data) * 1099511628211UL;
+	h = (h ^ tape[i].dtype) * 1099511628211UL;
+    }
+    h = (h ^ _ptr.pos) * 1099511628211UL;
+    h = (h ^ _ptr.data) * 1099511628211UL;
+    h = (h ^ _ptr.dtype) * 1099511628211UL;
+    return h;
+}
+
+void start_state_trace(const char *file_name, DWORD every)
+{
+    state_file = fopen(file_name, "w");
+    if (state_file == NULL) {
+	fprintf(stderr, "ERROR: Failed to create the state file");
+	exit(1);
+    }
+
+    if (every > 0) {
+	// round up to a power of 2
+	state_every = 1;
+	while (state_every < every) state_every <<= 1;
+	if (state_every - 1 < safe_point_mask) safe_point_mask = state_every - 1;
+    }
+    fprintf(state_file, "every %lu\n", state_every);
+}
+
+void write_final_state(const char *file_name)
+{
+    fprintf(state_file, "final %lu pos 0x%lx data 0x%lx dtype %u hash %016lx\n", steps, _ptr.pos, _ptr.data, _ptr.dtype, state_hash());
+    fclose(state_file);
+    state_file = NULL;
+
+    char tape_name[1024];
+    snprintf(tape_name, sizeof(tape_name), "%s.tape", file_name);
+
+    FILE *tape_file = fopen(tape_name, "wb");
+    if (tape_file == NULL) {
+	fprintf(stderr, "ERROR: Failed to create the tape state file");
+	exit(1);
+    }
+    fwrite(tape, sizeof(BLOCK), sizeof(tape) / sizeof(BLOCK), tape_file);
+    fclose(tape_file);
+}
+
+/*
+RESULT CELLS
+************
+
+"-emit-cells <RANGES>" writes the data and dtype of just the given cells into
+__CELLS_DUMP.tasm.<FORMAT> once the program halts, so that the results of a program can be
+read without printing them, or digging them out of a full memory dump. The ranges are
+separated by commas, and each is either a cell, "<FIRST>-<LAST>" (inclusive), or
+"<FIRST>:<COUNT>". Cells can be given as addresses or as variables, e.g.
+"-emit-cells 0x5-0x9,0x100:32,total".
+
+"-emit-format <FORMAT>" picks the format of the file:
+
+    json   an array of {"addr", "value", "dtype"} objects (the default)
+    csv    an "addr,value,dtype" header, and a line for every cell
+    bin    for every cell, its 8 data bytes (little-endian) and its dtype byte
+
+In json and csv, the value is shown as per the dtype of the cell (a T_INT is signed, a
+T_FLOAT is its double, and a T_CHAR is its code), and the dtype by its name. Only the
+cells asked for are ever read.
+*/
+
+#define EMIT_JSON 0
+#define EMIT_CSV 1
+#define EMIT_BIN 2
+
+typedef struct {
+    DWORD first;
+    DWORD count;
+} CELL_RANGE;
+
+static CELL_RANGE *emit_ranges = NULL;
+static int emit_range_count = 0;
+static int emit_format = EMIT_JSON;
+
+static const char *emit_extensions[] = { "json", "csv", "bin" };
+static const char *dtype_names[] = { "uint", "char", "float", "int" };
+
+// the address of a cell given as the whole of text (returns 0 if it is not one)
+int emit_address(const char *text, DWORD *addr)
+{
+    char *end = NULL;
+    if (*text == '\0') return 0;
+    *addr = cell_address(text, &end);
+    return end != text && *end == '\0' && *addr <= _END;
+}
+
+void parse_emit_cells(const char *list)
+{
+    const char *item = list;
+    while (1) {
+	size_t len = strcspn(item, ",");
+	char range[256], *separator;
+	if (len >= sizeof(range)) len = sizeof(range) - 1;
+	memcpy(range, item, len);
+	range[len] = '\0';
+
+	DWORD first, last, count = 1;
+	int ok;
+	if ((separator = strpbrk(range, "-:")) != NULL) {
+	    char kind = *separator;
+	    *separator = '\0';
+	    ok = emit_address(range, &first);
+	    if (kind == '-') {
+		ok = ok && emit_address(separator + 1, &last) && last >= first;
+		count = last - first + 1;
+	    } else {
+		char *end;
+		count = strtoul(separator + 1, &end, 0);
+		ok = ok && end != separator + 1 && *end == '\0' && count > 0 && count <= _END - first + 1;
+	    }
+	} else {
+	    ok = emit_address(range, &first);
+	}
+	if (!ok) {
+	    fprintf(stderr, "ERROR: Invalid range \"%.*s\" in -emit-cells", (int)strcspn(item, ","), item);
+	    exit(1);
+	}
+
+	emit_ranges = realloc(emit_ranges, sizeof(CELL_RANGE) * (emit_range_count + 1));
+	emit_ranges[emit_range_count].first = first;
+	emit_ranges[emit_range_count].count = count;
+	emit_range_count++;
+
+	item += strcspn(item, ",");
+	if (*item == '\0') break;
+	item++;
+    }
+}
+
+void emit_cells()
+{
+    char file_name[64];
+    snprintf(file_name, sizeof(file_name), "__CELLS_DUMP.tasm.%s", emit_extensions[emit_format]);
+
+    FILE *file = fopen(file_name, emit_format == EMIT_BIN ? "wb" : "w");
+    if (file == NULL) {
+	fprintf(stderr, "ERROR: Failed to create the cells dump file");
+	exit(1);
+    }
+
+    if (emit_format == EMIT_JSON) fprintf(file, "[");
+    if (emit_format == EMIT_CSV) fprintf(file, "addr,value,dtype\n");
+
+    int written = 0;
+    for (int r = 0; r < emit_range_count; r++) {
+	for (DWORD i = emit_ranges[r].first; i < emit_ranges[r].first + emit_ranges[r].count; i++) {
+	    BLOCK *cell = &tape[i];
+
+	    if (emit_format == EMIT_BIN) {
+		BYTE bytes[9];
+		for (int b = 0; b < 8; b++) bytes[b] = (BYTE)(cell->data >> (8 * b));
+		bytes[8] = cell->dtype;
+		fwrite(bytes, 1, sizeof(bytes), file);
+		continue;
+	    }
+
+	    char value[64];
+	    if (cell->dtype == T_FLOAT) {
+		double d = as_float(cell->data);
+		if (isfinite(d)) snprintf(value, sizeof(value), "%.17g", d);
+		else snprintf(value, sizeof(value), emit_format == EMIT_JSON ? "null" : "%g", d);
+	    }
+	    else if (cell->dtype == T_INT) snprintf(value, sizeof(value), "%ld", (long)cell->data);
+	    else snprintf(value, sizeof(value), "%lu", cell->data);
+	    const char *dtype = cell->dtype < 4 ? dtype_names[cell->dtype] : "unknown";
+
+	    if (emit_format == EMIT_JSON) {
+		fprintf(file, "%s\n  {\"addr\": %lu, \"value\": %s, \"dtype\": \"%s\"}", written ? "," : "", i, value, dtype);
+	    } else {
+		fprintf(file, "0x%lx,%s,%s\n", i, value, dtype);
+	    }
+	    written++;
+	}
+    }
+
+    if (emit_format == EMIT_JSON) fprintf(file, "\n]\n");
+    fclose(file);
+}
+
+// called by run() once every SAFE_POINT_INTERVAL steps (or more often, for state traces)
+void safe_point()
+{
+    if (state_every > 0 && (steps & (state_every - 1)) == 0) {
+	fprintf(state_file, "step %lu hash %016lx\n", steps, state_hash());
+    }
+
+    if ((steps & (SAFE_POINT_INTERVAL - 1)) != 0) return;
+
+    stats_publish();
+
+    if (compress) compress_epoch();
+
+    if ((keep_checkpoints || record_file != NULL) && (steps & (checkpoint_interval - 1)) == 0) take_checkpoint();
+
+#ifdef TASM_POSIX
+    if (snapshot_requested) take_snapshot();
+    if (reload_file != NULL) reload_arm();
+#endif
+}
+
+int debug_trap();
+int reload_trap();
+DWORD vm_fork();
+BLOCK vm_join();
+void vm_exit(const BLOCK *result);
+
+// execute the instruction at the current position of a tape pointer, with a set of registers
+// (contains all instruction implementations, returns 1 once the program halts)
+//
+// the machine itself runs with &_ptr and the tape as its registers (see execute()). the
+// workers of "-parallel" run leaf routines with their own pointer and registers.
+//
+// now is the number of steps executed so far, which run() keeps in a register rather than
+// in steps (the instructions that read steps store it first)
+static inline int execute_on(TAPE_PTR *p, BLOCK *reg, DWORD now)
+{
+    int is_halted = 0;
+
+    if (p->pos > _END) {
+	fprintf(stderr, "RUNTIME ERROR: Memory out of bounds. Address 0x%lx [%lu] does not exist", p->pos, p->pos);
+	if (memdump) generate_memory_dump();
+	exit(1);
+    }
+
+    // (the data of a non-instruction is not an address, so it can be anything)
+    DWORD addr = tape[p->pos].data;
+    if (addr > _END && tape[p->pos].ins != I_NONE) {
+	fprintf(stderr, "RUNTIME ERROR: Memory out of bounds. Address 0x%lx [%lu] does not exist", addr, addr);
+	if (memdump) generate_memory_dump();
+	exit(1);
+    }
+
+    // execute the instruction
+    switch (tape[p->pos].ins) {
+    case I_NONE:
+	p->pos++;
+	break;
+    case I_HALT:
+	vm_exit(NULL); // (a clone ends here, without a result)
+	is_halted = 1;
+	break;
+    case I_JUMP:
+	p->pos = addr;
+	break;
+    case I_CMP:
+	reg[_ZF].data = tape[addr].data == p->data;
+	reg[_CF].data = tape[addr].data < p->data;
+	p->pos++;
+	break;
+    case I_JE:
+	p->pos = reg[_ZF].data == 1 ? addr : p->pos + 1;
+	break;
+    case I_JNE:
+	p->pos = reg[_ZF].data == 0 ? addr : p->pos + 1;
+	break;
+    case I_JG:
+	p->pos = (reg[_ZF].data == 0 && reg[_CF].data == 0) ? addr : p->pos + 1;
+	break;
+    case I_JGE:
+	p->pos = reg[_CF].data == 0 ? addr : p->pos + 1;
+	break;
+    case I_JL:
+	p->pos = reg[_CF].data == 1 ? addr : p->pos + 1;
+	break;
+    case I_JLE:
+	p->pos = (reg[_ZF].data == 1 || reg[_CF].data == 1) ? addr : p->pos + 1;
+	break;
+    case I_READ:
+	p->data = tape[addr].data;
+	p->dtype = tape[addr].dtype;
+	p->pos++;
+	break;
+    case I_WRITE:
+	tape[addr].data = p->data;
+	tape[addr].dtype = p->dtype;
+
+	if (addr >= reg[_DISP].data && addr <= _OUT_END) reg[_DISP].data = addr + 1;
+	p->pos++;
+	break;
+    case I_AND:
+	tape[addr].data &= p->data;
+	p->pos++;
+	break;
+    case I_OR:
+	tape[addr].data |= p->data;
+	p->pos++;
+	break;
+    case I_XOR:
+	tape[addr].data ^= p->data;
+	p->pos++;
+	break;
+    case I_NOT:
+	tape[addr].data = !tape[addr].data;
+	p->pos++;
+	break;
+    case I_LSHIFT:
+	tape[addr].data <<= p->data;
+	p->pos++;
+	break;
+    case I_RSHIFT:
+	tape[addr].data >>= p->data;
+	p->pos++;
+	break;
+    case I_ADD:
+	tape[addr].data += p->data;
+	p->pos++;
+	break;
+    case I_SUB:
+	tape[addr].data -= p->data;
+	p->pos++;
+	break;
+    case I_MUL:
+	tape[addr].data *= p->data;
+	p->pos++;
+	break;
+    case I_DIV:
+	tape[addr].data /= p->data;
+	p->pos++;
+	break;
+    case I_FADD:
+	tape[addr].data = float_bits(as_float(tape[addr].data) + as_float(p->data));
+	tape[addr].dtype = T_FLOAT;
+	p->pos++;
+	break;
+    case I_FSUB:
+	tape[addr].data = float_bits(as_float(tape[addr].data) - as_float(p->data));
+	tape[addr].dtype = T_FLOAT;
+	p->pos++;
+	break;
+    case I_FMUL:
+	tape[addr].data = float_bits(as_float(tape[addr].data) * as_float(p->data));
+	tape[addr].dtype = T_FLOAT;
+	p->pos++;
+	break;
+    case I_FDIV:
+	tape[addr].data = float_bits(as_float(tape[addr].data) / as_float(p->data));
+	tape[addr].dtype = T_FLOAT;
+	p->pos++;
+	break;
+    case I_FSQRT:
+	tape[addr].data = float_bits(sqrt(as_float(tape[addr].data)));
+	tape[addr].dtype = T_FLOAT;
+	p->pos++;
+	break;
+    case I_FCMP: {
+	// (a NaN is neither equal nor less, so it compares as greater)
+	double a = as_float(tape[addr].data), b = as_float(p->data);
+	reg[_ZF].data = a == b;
+	reg[_CF].data = a < b;
+	p->pos++;
+	break;
+    }
+    case I_ITOF:
+	tape[addr].data = float_bits((double)tape[addr].data);
+	tape[addr].dtype = T_FLOAT;
+	p->pos++;
+	break;
+    case I_FTOI: {
+	// (negative numbers and NaN become 0, and numbers too large saturate)
+	double value = as_float(tape[addr].data);
+	if (value >= 18446744073709551616.0) tape[addr].data = ~0UL;
+	else tape[addr].data = value > 0 ? (DWORD)value : 0;
+	tape[addr].dtype = T_UINT;
+	p->pos++;
+	break;
+    }
+    case I_IMUL: {
+	long product;
+	reg[_OF].data = __builtin_mul_overflow((long)tape[addr].data, (long)p->data, &product);
+	tape[addr].data = (DWORD)product;
+	tape[addr].dtype = T_INT;
+	p->pos++;
+	break;
+    }
+    case I_IDIV:
+	// (the one quotient that does not fit, LONG_MIN / -1, wraps around like imul)
+	reg[_OF].data = (long)tape[addr].data == LONG_MIN && (long)p->data == -1;
+	if (!reg[_OF].data) tape[addr].data = (DWORD)((long)tape[addr].data / (long)p->data);
+	tape[addr].dtype = T_INT;
+	p->pos++;
+	break;
+    case I_SAR:
+	tape[addr].data = (DWORD)((long)tape[addr].data >> (p->data < 64 ? p->data : 63));
+	tape[addr].dtype = T_INT;
+	p->pos++;
+	break;
+    case I_ICMP: {
+	long difference;
+	reg[_ZF].data = tape[addr].data == p->data;
+	reg[_CF].data = tape[addr].data < p->data;
+	reg[_OF].data = __builtin_sub_overflow((long)tape[addr].data, (long)p->data, &difference);
+	reg[_SF].data = difference < 0;
+	p->pos++;
+	break;
+    }
+    case I_JLT:
+	p->pos = reg[_SF].data != reg[_OF].data ? addr : p->pos + 1;
+	break;
+    case I_JGT:
+	p->pos = (reg[_ZF].data == 0 && reg[_SF].data == reg[_OF].data) ? addr : p->pos + 1;
+	break;
+    case I_OUT:
+	output();
+	break;
+    case I_OUTRAW:
+	output_raw(addr, p->data >> 2, p->data & 3);
+	p->pos++;
+	break;
+    case I_TRAP:
+	is_halted = debug_trap();
+	break;
+    case I_RELOAD:
+	steps = now;
+	is_halted = reload_trap();
+	break;
+    case I_CLK:
+	steps = now;
+	tape[addr].data = read_input(I_CLK);
+	tape[addr].dtype = T_UINT;
+	p->pos++;
+	break;
+    case I_TSC:
+	steps = now;
+	tape[addr].data = read_input(I_TSC);
+	tape[addr].dtype = T_UINT;
+	p->pos++;
+	break;
+    case I_STEPS:
+	tape[addr].data = now;
+	tape[addr].dtype = T_UINT;
+	p->pos++;
+	break;
+    case I_VFORK:
+	tape[addr].data = vm_fork();
+	tape[addr].dtype = T_UINT;
+	p->pos++;
+	break;
+    case I_VJOIN: {
+	BLOCK result = vm_join();
+	tape[addr].data = result.data;
+	tape[addr].dtype = result.dtype;
+	p->pos++;
+	break;
+    }
+    case I_VEXIT:
+	vm_exit(&tape[addr]);
+	is_halted = 1;
+	break;
+    case I_CALL:
+	if (reg[_STK].data < stack_floor_of(reg)) {
+	    fprintf(stderr, "RUNTIME ERROR: Stack overflow occurred. Execution terminated.");
+	    if (memdump) generate_memory_dump();
+	    exit(1);
+	}
+	tape[reg[_STK].data].data = p->pos + 1;
+	reg[_STK].data--;
+	p->pos = addr;
+	break;
+    case I_RET:
+	reg[_STK].data++;
+	p->pos = tape[reg[_STK].data].data;
+	break;
+    case I_COCREATE: {
+	DWORD top = coroutine_top(p->data);
+	if (p->data >= COROUTINE_MAX || coroutine_running(reg, p->data)) {
+	    fprintf(stderr, "RUNTIME ERROR: Coroutine %lu cannot be created while it is running, or is not a valid id", p->data);
+	    if (memdump) generate_memory_dump();
+	    exit(1);
+	}
+	tape[top].data = top - COROUTINE_STATE;
+	tape[top - 1].data = addr;
+	p->pos++;
+	break;
+    }
+    case I_RESUME: {
+	DWORD top = coroutine_top(addr);
+	if (addr >= COROUTINE_MAX || tape[top].data == 0) {
+	    fprintf(stderr, "RUNTIME ERROR: Coroutine %lu is not suspended, so it cannot be resumed", addr);
+	    if (memdump) generate_memory_dump();
+	    exit(1);
+	}
+	tape[top - 2].data = reg[_CO].data;
+	tape[top - 3].data = reg[_STK].data;
+	tape[top - 4].data = p->pos + 1;
+	reg[_CO].data = addr + 1;
+	reg[_STK].data = tape[top].data;
+	tape[top].data = 0;
+	p->pos = tape[top - 1].data;
+	break;
+    }
+    case I_YIELD: {
+	DWORD top = coroutine_top(addr);
+	if (reg[_CO].data != addr + 1) {
+	    fprintf(stderr, "RUNTIME ERROR: Coroutine %lu is not the one running, so it cannot yield", addr);
+	    if (memdump) generate_memory_dump();
+	    exit(1);
+	}
+	tape[top].data = reg[_STK].data;
+	tape[top - 1].data = p->pos + 1;
+	reg[_CO].data = tape[top - 2].data;
+	reg[_STK].data = tape[top - 3].data;
+	p->pos = tape[top - 4].data;
+	break;
+    }
+    default:
+	fprintf(stderr, "RUNTIME ERROR: Invalid instruction :: %u", tape[p->pos].ins);
+	if (memdump) generate_memory_dump();
+	exit(1);
+    }
+    return is_halted;
+}
+
+// execute the instruction at the current position of the tape pointer
+static inline int execute()
+{
+    return execute_on(&_ptr, tape, steps);
+}
+
+// run the program on the turing machine (tape)
+void run()
+{
+    if (exact_steps) {
+	while (!execute()) {
+	    steps++;
+	    if ((steps & safe_point_mask) == 0) safe_point();
+	}
+	return;
+    }
+
+    // count the steps in a register, and only store them at safe points and once halted
+    DWORD now = steps;
+    DWORD next = (now | safe_point_mask) + 1;
+    while (!execute_on(&_ptr, tape, now)) {
+	if (++now == next) {
+	    steps = now;
+	    safe_point();
+	    next = now + safe_point_mask + 1;
+	}
+    }
+    steps = now;
+}
+
+#ifdef TASM_POSIX
+/*
+PARALLEL CALLS
+**************
+
+With "-parallel", runs of consecutive calls to independent leaf routines are executed
+concurrently, on worker threads.
+
+A routine can be run by a worker if, looking at every instruction it can reach from its entry:
+
+    (1) it is a leaf (it has no call, out, hlt, steps, clk or tsc)
+    (2) every cell it reads and writes is known once the program is loaded (so it does not
+	dereference, which patches the code), and none of them is a register or on the stack
+    (3) it sets _ptr.data and the flags before it reads them (on the straight line from its
+	entry, which every run goes through), and sets the same flags on every path
+    (4) it has a loop (otherwise, it is too short to be worth handing to a thread)
+
+Two calls are independent if neither writes a cell that the other reads or writes. A run of
+2 or more consecutive, pairwise independent calls (a batch) is executed with one call per
+worker, each with its own tape pointer and registers. The registers are then merged back as
+if the calls had run one after the other: the flags and _ptr come from the last call that set
+them, and _DISP is the highest of them. As the calls write disjoint display cells, the output
+is the same as that of the calls run in program order (and so is the count of steps).
+
+The routines must not be overwritten at runtime through a pointer, as they are only analyzed
+once the program is loaded. -parallel cannot be combined with the debugger, -watch, -record,
+-replay, -state or -engine, all of which follow the machine one step at a time.
+*/
+
+#define PARALLEL_MAX_BODY 4096 // cells of a routine that are looked at, at most
+#define PARALLEL_MAX_CALLS 64  // calls in a batch, at most
+
+// the flag registers, as bits of LEAF.flags
+static const DWORD flag_cells[] = { _ZF, _CF, _SF, _OF };
+#define FLAG_ZF 1
+#define FLAG_CF 2
+#define FLAG_SF 4
+#define FLAG_OF 8
+
+typedef struct {
+    DWORD *cells;
+    int count, capacity;
+} CELL_SET;
+
+typedef struct {
+    DWORD entry;
+    int ok;         // whether the routine can be run by a worker
+    int flags;      // flags set by every run of the routine
+    CELL_SET reads, writes;
+} LEAF;
+
+static LEAF **leaves = NULL;
+static int leaf_count = 0;
+static BYTE *code_written = NULL; // cells of instruction memory written by the program itself
+static BYTE *batch_size = NULL;   // number of calls in the batch starting at each cell of instruction memory
+static int *leaf_seen = NULL;     // (the leaf whose analysis last reached each cell)
+
+void cell_set_add(CELL_SET *set, DWORD addr)
+{
+    if (set->count == set->capacity) {
+	set->capacity = set->capacity ? set->capacity * 2 : 16;
+	set->cells = realloc(set->cells, sizeof(DWORD) * set->capacity);
+    }
+    set->cells[set->count++] = addr;
+}
+
+int compare_cells(const void *a, const void *b)
+{
+    DWORD x = *(const DWORD *)a, y = *(const DWORD *)b;
+    return x < y ? -1 : x > y;
+}
+
+// sort the cells, and drop the duplicates
+void cell_set_sort(CELL_SET *set)
+{
+    if (set->count == 0) return;
+    qsort(set->cells, set->count, sizeof(DWORD), compare_cells);
+
+    int unique = 1;
+    for (int i = 1; i < set->count; i++) {
+	if (set->cells[i] != set->cells[unique - 1]) set->cells[unique++] = set->cells[i];
+    }
+    set->count = unique;
+}
+
+// whether two sorted sets have a cell in common
+int cell_sets_meet(const CELL_SET *a, const CELL_SET *b)
+{
+    int i = 0, j = 0;
+    while (i < a->count && j < b->count) {
+	if (a->cells[i] == b->cells[j]) return 1;
+	if (a->cells[i] < b->cells[j]) i++;
+	else j++;
+    }
+    return 0;
+}
+
+// whether a leaf can use the cell (directly, and at the same time as the other leaves of its batch)
+int leaf_cell(DWORD addr, int is_write)
+{
+    if (addr < _SAFE_MEM || addr > _END) return 0;
+    if (addr > _SAFE_MEM_END && addr < _OUT) return 0; // _SF, _OF and the stack
+    return !is_write || addr < _MAIN;
+}
+
+// flags set by an instruction
+int flags_set(INSTRUCTION ins)
+{
+    if (ins == I_CMP || ins == I_FCMP) return FLAG_ZF | FLAG_CF;
+    if (ins == I_ICMP) return FLAG_ZF | FLAG_CF | FLAG_SF | FLAG_OF;
+    if (ins == I_IMUL || ins == I_IDIV) return FLAG_OF;
+    return 0;
+}
+
+// flags read by an instruction (-1 if it is not a conditional jump)
+int flags_read(INSTRUCTION ins)
+{
+    switch (ins) {
+    case I_JE: case I_JNE: return FLAG_ZF;
+    case I_JGE: case I_JL: return FLAG_CF;
+    case I_JG: case I_JLE: return FLAG_ZF | FLAG_CF;
+    case I_JLT: return FLAG_SF | FLAG_OF;
+    case I_JGT: return FLAG_ZF | FLAG_SF | FLAG_OF;
+    default: return -1;
+    }
+}
+
+// whether an instruction reads its address (1), writes it (2), or both (3), while using _ptr.data (4)
+int leaf_access(INSTRUCTION ins)
+{
+    switch (ins) {
+    case I_READ:
+	return 1;
+    case I_CMP: case I_FCMP: case I_ICMP:
+	return 1 | 4;
+    case I_WRITE:
+	return 2 | 4;
+    case I_NOT: case I_FSQRT: case I_ITOF: case I_FTOI:
+	return 1 | 2;
+    case I_AND: case I_OR: case I_XOR: case I_LSHIFT: case I_RSHIFT:
+    case I_ADD: case I_SUB: case I_MUL: case I_DIV:
+    case I_FADD: case I_FSUB: case I_FMUL: case I_FDIV:
+    case I_IMUL: case I_IDIV: case I_SAR:
+	return 1 | 2 | 4;
+    default:
+	return 0;
+    }
+}
+
+// find the cells a routine reads and writes, and whether it can be run by a worker
+void analyze_leaf(LEAF *leaf, int id)
+{
+    DWORD pending[PARALLEL_MAX_BODY];
+    int pending_count = 0, cells = 0, has_loop = 0, may_set = 0, reads_flags = 0;
+
+    pending[pending_count++] = leaf->entry;
+    while (pending_count > 0) {
+	DWORD pos = pending[--pending_count];
+	if (pos < _MAIN || pos > code_end || pending_count + 2 > PARALLEL_MAX_BODY) return;
+	if (leaf_seen[pos - _MAIN] == id) continue;
+	leaf_seen[pos - _MAIN] = id;
+	if (++cells > PARALLEL_MAX_BODY || code_written[pos - _MAIN]) return;
+
+	INSTRUCTION ins = tape[pos].ins;
+	DWORD addr = tape[pos].data;
+	int access = leaf_access(ins);
+
+	if (ins == I_RET) continue;
+	if (ins == I_JUMP || flags_read(ins) >= 0) {
+	    if (addr <= pos) has_loop = 1;
+	    if (ins != I_JUMP) reads_flags |= flags_read(ins);
+	    pending[pending_count++] = addr;
+	    if (ins == I_JUMP) continue;
+	} else if (access) {
+	    if ((access & 1) && !leaf_cell(addr, 0)) return;
+	    if ((access & 2) && !leaf_cell(addr, 1)) return;
+	    if (access & 1) cell_set_add(&leaf->reads, addr);
+	    if (access & 2) cell_set_add(&leaf->writes, addr);
+	    may_set |= flags_set(ins);
+	} else if (ins != I_NONE) {
+	    return;
+	}
+	pending[pending_count++] = pos + 1;
+    }
+
+    // the straight line from the entry (upto the first conditional jump)
+    int must_set = 0, data_set = 0;
+    DWORD pos = leaf->entry;
+    for (int i = 0; i < cells && tape[pos].ins != I_RET && flags_read(tape[pos].ins) < 0; i++) {
+	if (tape[pos].ins == I_JUMP) {
+	    pos = tape[pos].data;
+	    continue;
+	}
+	if (tape[pos].ins == I_READ) data_set = 1;
+	else if (!data_set && (leaf_access(tape[pos].ins) & 4)) return;
+	must_set |= flags_set(tape[pos].ins);
+	pos++;
+    }
+    if (!data_set || (reads_flags & ~must_set) || may_set != must_set || !has_loop) return;
+
+    cell_set_sort(&leaf->reads);
+    cell_set_sort(&leaf->writes);
+    leaf->flags = must_set;
+    leaf->ok = 1;
+}
+
+// the leaf called by a cell (NULL if the cell is not a call that can be run by a worker)
+LEAF *leaf_called_by(DWORD pos)
+{
+    if (tape[pos].ins != I_CALL || code_written[pos - _MAIN]) return NULL;
+
+    DWORD entry = tape[pos].data;
+    for (int i = 0; i < leaf_count; i++) {
+	if (leaves[i]->entry == entry) return leaves[i]->ok ? leaves[i] : NULL;
+    }
+
+    LEAF *leaf = calloc(1, sizeof(LEAF));
+    leaf->entry = entry;
+    leaves = realloc(leaves, sizeof(LEAF *) * (leaf_count + 1));
+    leaves[leaf_count++] = leaf;
+    analyze_leaf(leaf, leaf_count);
+    return leaf->ok ? leaf : NULL;
+}
+
+int leaves_independent(const LEAF *a, const LEAF *b)
+{
+    return !cell_sets_meet(&a->writes, &b->writes) && !cell_sets_meet(&a->writes, &b->reads) &&
+	!cell_sets_meet(&a->reads, &b->writes);
+}
+
+/* worker threads */
+
+typedef struct {
+    TAPE_PTR ptr;
+    DWORD steps;
+    DWORD flags[4]; // (in the order of flag_cells)
+    DWORD disp;
+} PARALLEL_CALL;
+
+static PARALLEL_CALL parallel_calls[PARALLEL_MAX_CALLS];
+static int parallel_count = 0; // calls in the current batch
+static int parallel_next = 0;  // next call of the batch to be run (workers still busy with the last batch may take it too)
+static int parallel_done = 0;
+static unsigned long parallel_generation = 0; // (bumped for every batch)
+static BLOCK *parallel_registers = NULL;      // registers of the main thread, while running calls
+static pthread_mutex_t parallel_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t parallel_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t parallel_finished = PTHREAD_COND_INITIALIZER;
+
+// run one call of the batch upto its ret, with a set of registers
+void run_parallel_call(PARALLEL_CALL *call, BLOCK *reg)
+{
+    reg[_DISP].data = tape[_DISP].data;
+
+    DWORD count = 1; // (the ret)
+    while (tape[call->ptr.pos].ins != I_RET) {
+	execute_on(&call->ptr, reg, 0); // (leaves do not read steps)
+	count++;
+    }
+
+    call->steps = count;
+    for (int i = 0; i < 4; i++) call->flags[i] = reg[flag_cells[i]].data;
+    call->disp = reg[_DISP].data;
+}
+
+// run calls of the current batch, until there are none left
+void parallel_work(BLOCK *reg)
+{
+    int k;
+    while ((k = __atomic_fetch_add(&parallel_next, 1, __ATOMIC_SEQ_CST)) < __atomic_load_n(&parallel_count, __ATOMIC_SEQ_CST)) {
+	run_parallel_call(&parallel_calls[k], reg);
+
+	pthread_mutex_lock(&parallel_lock);
+	if (++parallel_done == parallel_count) pthread_cond_signal(&parallel_finished);
+	pthread_mutex_unlock(&parallel_lock);
+    }
+}
+
+void *parallel_worker(void *registers)
+{
+    unsigned long generation = 0;
+    while (1) {
+	pthread_mutex_lock(&parallel_lock);
+	while (parallel_generation == generation) pthread_cond_wait(&parallel_wake, &parallel_lock);
+	generation = parallel_generation;
+	pthread_mutex_unlock(&parallel_lock);
+
+	parallel_work(registers);
+    }
+    return NULL;
+}
+
+// find the batches of the loaded program, and start the worker threads
+void parallel_start()
+{
+    code_written = calloc(INSTR_SIZE, 1);
+    batch_size = calloc(INSTR_SIZE, 1);
+    leaf_seen = calloc(INSTR_SIZE, sizeof(int));
+
+    for (DWORD pos = _MAIN; pos <= code_end; pos++) {
+	DWORD addr = tape[pos].data;
+	if ((leaf_access(tape[pos].ins) & 2) && addr >= _MAIN && addr <= _END) code_written[addr - _MAIN] = 1;
+    }
+
+    int batches = 0;
+    for (DWORD pos = _MAIN; pos <= code_end; ) {
+	LEAF *batch[PARALLEL_MAX_CALLS];
+	int count = 0;
+	while (count < PARALLEL_MAX_CALLS && pos + count <= code_end) {
+	    LEAF *leaf = leaf_called_by(pos + count);
+	    if (leaf == NULL) break;
+
+	    int independent = 1;
+	    for (int i = 0; i < count && independent; i++) independent = leaves_independent(batch[i], leaf);
+	    if (!independent) break;
+	    batch[count++] = leaf;
+	}
+
+	if (count < 2) {
+	    pos++;
+	    continue;
+	}
+	batch_size[pos - _MAIN] = count;
+	fprintf(stderr, "PARALLEL [Line %d]: %d calls run concurrently\n", source_line[pos - _MAIN], count);
+	batches++;
+	pos += count;
+    }
+    if (batches == 0) return;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus > PARALLEL_MAX_CALLS ? PARALLEL_MAX_CALLS - 1 : (int)cpus - 1;
+
+    parallel_registers = calloc(STORE_SIZE, sizeof(BLOCK));
+    for (int i = 0; i < workers; i++) {
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, parallel_worker, calloc(STORE_SIZE, sizeof(BLOCK))) != 0) break;
+	pthread_detach(thread);
+    }
+}
+
+// run the batch at the current position, as if its calls were executed one after the other
+void run_batch(int count)
+{
+    DWORD call_pos = _ptr.pos;
+    for (int k = 0; k < count; k++) {
+	parallel_calls[k].ptr.pos = tape[call_pos + k].data;
+	parallel_calls[k].ptr.data = _ptr.data;
+	parallel_calls[k].ptr.dtype = _ptr.dtype;
+    }
+
+    pthread_mutex_lock(&parallel_lock);
+    __atomic_store_n(&parallel_count, count, __ATOMIC_SEQ_CST);
+    parallel_done = 0;
+    __atomic_store_n(&parallel_next, 0, __ATOMIC_SEQ_CST);
+    parallel_generation++;
+    pthread_cond_broadcast(&parallel_wake);
+    pthread_mutex_unlock(&parallel_lock);
+
+    parallel_work(parallel_registers);
+
+    pthread_mutex_lock(&parallel_lock);
+    while (parallel_done < count) pthread_cond_wait(&parallel_finished, &parallel_lock);
+    pthread_mutex_unlock(&parallel_lock);
+
+    DWORD steps_before = steps;
+    for (int k = 0; k < count; k++) {
+	const PARALLEL_CALL *call = &parallel_calls[k];
+	const LEAF *leaf = leaf_called_by(call_pos + k);
+
+	steps += 1 + call->steps; // (the call itself, and the routine)
+	if (call->disp > tape[_DISP].data) tape[_DISP].data = call->disp;
+	for (int i = 0; i < 4; i++) {
+	    if (leaf->flags & (1 << i)) tape[flag_cells[i]].data = call->flags[i];
+	}
+    }
+    _ptr.data = parallel_calls[count - 1].ptr.data;
+    _ptr.dtype = parallel_calls[count - 1].ptr.dtype;
+
+    // (the stack keeps the return address of the last call, as the calls leave it behind)
+    tape[tape[_STK].data].data = call_pos + count;
+    _ptr.pos = call_pos + count;
+
+    if (steps / SAFE_POINT_INTERVAL != steps_before / SAFE_POINT_INTERVAL) {
+	stats_publish();
+	if (snapshot_requested) take_snapshot();
+    }
+}
+
+// run the program, with its batches on the worker threads
+void run_parallel()
+{
+    while (1) {
+	DWORD cell = _ptr.pos - _MAIN;
+	if (cell < INSTR_SIZE && batch_size[cell] && tape[_STK].data >= stack_floor_of(tape)) {
+	    run_batch(batch_size[cell]);
+	    continue;
+	}
+
+	if (execute()) break;
+	steps++;
+	if ((steps & safe_point_mask) == 0) safe_point();
+    }
+}
+#endif
+
+/*
+WATCHPOINTS
+***********
+
+A watchpoint reports every write to a cell of the tape, along with the position
+(and source line) of the instruction that wrote it. Running with "-watch <ADDR>,..."
+watches the given cells from the start, and the debugger can add more with "w".
+
+Rather than checking every write in run(), the page of the tape that holds a watched
+cell is made read-only. A write to it faults, and the fault handler reports the write
+if it hit a watched cell. It then makes the page writable, and sets the trap flag of
+the cpu so that exactly one host instruction (the write) executes before the page is
+protected again. Unwatched cells that share the page only pay for the fault.
+
+(This relies on Linux and x86-64 for the single-stepping)
+*/
+
+#define MAX_WATCHPOINTS 64
+
+static DWORD watchpoints[MAX_WATCHPOINTS];
+static int watchpoint_count = 0;
+
+#ifdef TASM_WATCHPOINTS
+static char *watch_page = NULL;     // page being written (unprotected for one host instruction)
+static long watch_cell = -1;        // watched cell being written
+static BLOCK watch_old;             // its value before the write
+static DWORD watch_last_step = -1;  // the last reported write (an instruction can store
+static long watch_last_cell = -1;   // to the same cell more than once)
+
+char *page_of(const void *addr)
+{
+    return (char *)((unsigned long)addr & ~(unsigned long)(PAGE_SIZE - 1));
+}
+
+int is_watched(long cell)
+{
+    for (int i = 0; i < watchpoint_count; i++) {
+	if ((long)watchpoints[i] == cell) return 1;
+    }
+    return 0;
+}
+
+int is_watched_page(const char *page)
+{
+    for (int i = 0; i < watchpoint_count; i++) {
+	if (page_of(&tape[watchpoints[i]]) == page) return 1;
+    }
+    return 0;
+}
+
+void watch_fault(int sig, siginfo_t *info, void *context)
+{
+    char *addr = info->si_addr;
+    char *page = page_of(addr);
+
+    // not a write to a watched page, so let the fault crash the program as usual
+    if (addr < (char *)tape || addr >= (char *)(tape + sizeof(tape) / sizeof(BLOCK)) || !is_watched_page(page)) {
+	signal(sig, SIG_DFL);
+	return;
+    }
+
+    long cell = (addr - (char *)tape) / sizeof(BLOCK);
+    watch_cell = is_watched(cell) ? cell : -1;
+    if (watch_cell >= 0) watch_old = tape[cell];
+
+    // let the faulting instruction write, for exactly one host instruction
+    watch_page = page;
+    mprotect(page, PAGE_SIZE, PROT_READ | PROT_WRITE);
+    ((ucontext_t *)context)->uc_mcontext.gregs[REG_EFL] |= 0x100;
+}
+
+void watch_step(int sig, siginfo_t *info, void *context)
+{
+    (void)sig;
+    (void)info;
+    ((ucontext_t *)context)->uc_mcontext.gregs[REG_EFL] &= ~0x100UL;
+
+    if (watch_cell >= 0 && (watch_last_step != steps || watch_last_cell != watch_cell)) {
+	const char *label = map_find_enclosing(label_to_address_map, _ptr.pos);
+	int line = (_ptr.pos >= _MAIN && _ptr.pos <= _END) ? source_line[_ptr.pos - _MAIN] : 0;
+
+	fprintf(stderr, "WATCH: [step %lu] 0x%lx written by 0x%08lx (%s) [Line %d]: 0x%lx -> 0x%lx\n",
+		steps, watch_cell, _ptr.pos, label ? label : "?", line, watch_old.data, tape[watch_cell].data);
+	watch_last_step = steps;
+	watch_last_cell = watch_cell;
+    }
+
+    if (watch_page != NULL) mprotect(watch_page, PAGE_SIZE, PROT_READ);
+    watch_page = NULL;
+    watch_cell = -1;
+}
+#endif
+
+// let the debugger rewrite the tape without triggering watchpoints
+void unprotect_watched_pages()
+{
+#ifdef TASM_WATCHPOINTS
+    for (int i = 0; i < watchpoint_count; i++) mprotect(page_of(&tape[watchpoints[i]]), PAGE_SIZE, PROT_READ | PROT_WRITE);
+#endif
+}
+
+void protect_watched_pages()
+{
+#ifdef TASM_WATCHPOINTS
+    for (int i = 0; i < watchpoint_count; i++) mprotect(page_of(&tape[watchpoints[i]]), PAGE_SIZE, PROT_READ);
+#endif
+}
+
+// start watching writes to a cell of the tape
+int add_watchpoint(DWORD addr)
+{
+#ifdef TASM_WATCHPOINTS
+    if (compress) {
+	fprintf(stderr, "ERROR: Watchpoints cannot be used with -compress\n");
+	return 0;
+    }
+    if (addr > _END || watchpoint_count == MAX_WATCHPOINTS) return 0;
+
+    if (watchpoint_count == 0) {
+	struct sigaction action = {0};
+	action.sa_flags = SA_SIGINFO;
+
+	action.sa_sigaction = watch_fault;
+	sigaction(SIGSEGV, &action, NULL);
+	action.sa_sigaction = watch_step;
+	sigaction(SIGTRAP, &action, NULL);
+    }
+
+    watchpoints[watchpoint_count++] = addr;
+    mprotect(page_of(&tape[addr]), PAGE_SIZE, PROT_READ);
+    return 1;
+#else
+    (void)addr;
+    fprintf(stderr, "ERROR: Watchpoints are not supported on this platform\n");
+    return 0;
+#endif
+}
+
+/*
+COLD PAGE COMPRESSION
+*********************
+
+With "-compress", the pages of storage, stack and display memory that the program has
+stopped using are compressed in place, so that a machine which sits on a large tape (or
+many of them, on one host) only keeps the pages it works with resident.
+
+Every COMPRESS_EPOCH steps (at a safe point), the pages used since the last epoch are made
+inaccessible (PROT_NONE), and the ones that were not touched during the whole epoch are
+compressed: a page of zeros keeps nothing at all, and any other page keeps a run-length
+encoding of its 8 byte words (most cells are mostly zeros, as only the data of a block is
+set outside instruction memory), as long as that saves at least a quarter of the page.
+The memory of a compressed page is then given back to the system (MADV_DONTNEED). A page
+that does not compress that well is left readable, and is not encoded again until it is
+written.
+
+The first touch of an inaccessible page faults, and the fault handler makes it accessible
+again (decompressing it first, if needed) before the instruction is retried. So a page in
+use costs one fault per epoch, and the program behaves exactly the same way. (The handler
+does not free the compressed data, which is left to the next safe point.)
+
+(Instruction memory is always resident, as it is used on every step. Like watchpoints,
+this relies on the fault handler, so the two cannot be combined.)
+
+ENCODING:
+
+    <HEADER>                  (a run of COUNT zero words, if the kind is COMPRESS_ZEROS)
+    <HEADER> <WORD>           (a run of COUNT copies of WORD, if the kind is COMPRESS_RUN)
+    <HEADER> <COUNT WORDS>    (COUNT words as they are, if the kind is COMPRESS_LITERAL)
+
+    where HEADER is 2 bytes (the kind in the top 2 bits, and COUNT in the rest), and a WORD is 8 bytes
+*/
+
+#define COMPRESS_EPOCH (1UL << 22)
+#define COMPRESS_WORDS (PAGE_SIZE / sizeof(DWORD))
+#define COMPRESS_LITERAL 0x0000
+#define COMPRESS_ZEROS 0x4000
+#define COMPRESS_RUN 0x8000
+#define COMPRESS_KIND 0xc000
+
+enum { PAGE_HOT, PAGE_COOLING, PAGE_COMPRESSED, PAGE_DENSE };
+
+typedef struct {
+    BYTE state;
+    unsigned short size; // (of the compressed data, 0 for a page of zeros)
+    BYTE *data;
+} TAPE_PAGE;
+
+#ifdef TASM_POSIX
+static TAPE_PAGE *tape_pages = NULL; // the pages below instruction memory
+static DWORD tape_page_count = 0;
+static DWORD compress_faults = 0;
+static BYTE **released = NULL; // compressed data of the pages warmed since the last safe point
+static DWORD released_count = 0;
+
+// encode a page (returns the size of the encoding)
+DWORD encode_page(const DWORD *words, BYTE *out)
+{
+    DWORD used = 0;
+    for (DWORD i = 0; i < COMPRESS_WORDS;) {
+	DWORD run = 1;
+	while (i + run < COMPRESS_WORDS && words[i + run] == words[i]) run++;
+
+	unsigned short header;
+	if (words[i] == 0 || run > 1) {
+	    header = (words[i] == 0 ? COMPRESS_ZEROS : COMPRESS_RUN) | run;
+	    memcpy(out + used, &header, sizeof(header));
+	    used += sizeof(header);
+	    if (words[i] != 0) {
+		memcpy(out + used, &words[i], sizeof(DWORD));
+		used += sizeof(DWORD);
+	    }
+	    i += run;
+	    continue;
+	}
+
+	// (literals go on until the next zero, or run)
+	DWORD count = 1;
+	while (i + count < COMPRESS_WORDS && words[i + count] != 0 &&
+	       !(i + count + 1 < COMPRESS_WORDS && words[i + count] == words[i + count + 1])) count++;
+
+	header = COMPRESS_LITERAL | count;
+	memcpy(out + used, &header, sizeof(header));
+	memcpy(out + used + sizeof(header), &words[i], count * sizeof(DWORD));
+	used += sizeof(header) + count * sizeof(DWORD);
+	i += count;
+    }
+    return used;
+}
+
+void decode_page(const BYTE *in, DWORD size, DWORD *words)
+{
+    for (DWORD used = 0, i = 0; used < size;) {
+	unsigned short header;
+	memcpy(&header, in + used, sizeof(header));
+	used += sizeof(header);
+
+	DWORD count = header & ~COMPRESS_KIND;
+	if ((header & COMPRESS_KIND) == COMPRESS_ZEROS) {
+	    i += count; // (the page reads as zeros already)
+	} else if ((header & COMPRESS_KIND) == COMPRESS_RUN) {
+	    DWORD word;
+	    memcpy(&word, in + used, sizeof(DWORD));
+	    for (DWORD k = 0; k < count; k++) words[i++] = word;
+	    used += sizeof(DWORD);
+	} else {
+	    memcpy(&words[i], in + used, count * sizeof(DWORD));
+	    used += count * sizeof(DWORD);
+	    i += count;
+	}
+    }
+}
+
+// make a page accessible again (decompressing it, if it was compressed)
+// (called by the fault handler, so the compressed data is only freed by free_released())
+void warm_page(DWORD index)
+{
+    TAPE_PAGE *page = &tape_pages[index];
+    char *start = (char *)tape + index * PAGE_SIZE;
+
+    mprotect(start, PAGE_SIZE, PROT_READ | PROT_WRITE);
+    if (page->state == PAGE_COMPRESSED) {
+	// (the page reads as zeros since MADV_DONTNEED)
+	if (page->size > 0) decode_page(page->data, page->size, (DWORD *)start);
+	if (page->data != NULL) released[released_count++] = page->data;
+	page->data = NULL;
+    }
+    page->state = PAGE_HOT;
+}
+
+void free_released()
+{
+    for (DWORD i = 0; i < released_count; i++) free(released[i]);
+    released_count = 0;
+}
+
+void compress_fault(int sig, siginfo_t *info, void *context)
+{
+    (void)context;
+    char *addr = info->si_addr;
+
+    // not an access to a cold page, so let the fault crash the program as usual
+    if (addr < (char *)tape || addr >= (char *)tape + tape_page_count * PAGE_SIZE ||
+	tape_pages[(addr - (char *)tape) / PAGE_SIZE].state == PAGE_HOT) {
+	signal(sig, SIG_DFL);
+	return;
+    }
+
+    warm_page((addr - (char *)tape) / PAGE_SIZE);
+    compress_faults++;
+}
+
+// compress the pages left untouched since the last epoch, and start watching the others
+// (called at every safe point)
+void compress_epoch()
+{
+    static BYTE encoded[PAGE_SIZE * 2];
+    free_released();
+    if ((steps & (COMPRESS_EPOCH - 1)) != 0) return;
+
+    for (DWORD i = 0; i < tape_page_count; i++) {
+	TAPE_PAGE *page = &tape_pages[i];
+	char *start = (char *)tape + i * PAGE_SIZE;
+
+	if (page->state == PAGE_HOT) {
+	    mprotect(start, PAGE_SIZE, PROT_NONE);
+	    page->state = PAGE_COOLING;
+	} else if (page->state == PAGE_COOLING) {
+	    mprotect(start, PAGE_SIZE, PROT_READ);
+	    DWORD size = encode_page((const DWORD *)start, encoded);
+	    int is_zero = size == sizeof(unsigned short) && ((const DWORD *)start)[0] == 0;
+
+	    if (is_zero || size <= PAGE_SIZE * 3 / 4) {
+		page->size = is_zero ? 0 : size;
+		page->data = is_zero ? NULL : malloc(size);
+		if (!is_zero) memcpy(page->data, encoded, size);
+
+		madvise(start, PAGE_SIZE, MADV_DONTNEED);
+		page->state = PAGE_COMPRESSED;
+		mprotect(start, PAGE_SIZE, PROT_NONE);
+	    } else {
+		page->state = PAGE_DENSE; // (left readable, until a write faults)
+	    }
+	}
+    }
+}
+#else
+void compress_epoch() {}
+#endif
+
+void compress_start()
+{
+#ifdef TASM_POSIX
+    tape_page_count = _MAIN * sizeof(BLOCK) / PAGE_SIZE;
+    tape_pages = calloc(tape_page_count, sizeof(TAPE_PAGE));
+    released = malloc(tape_page_count * sizeof(BYTE *)); // (a page is warmed at most once in between safe points)
+
+    struct sigaction action = {0};
+    action.sa_flags = SA_SIGINFO;
+    action.sa_sigaction = compress_fault;
+    sigaction(SIGSEGV, &action, NULL);
+#else
+    fprintf(stderr, "ERROR: -compress is not supported on this platform");
+    exit(1);
+#endif
+}
+
+// make every page accessible again (before the tape is handed to a system call), and report
+void compress_stop()
+{
+#ifdef TASM_POSIX
+    DWORD compressed = 0, zero = 0, kept = 0;
+    for (DWORD i = 0; i < tape_page_count; i++) {
+	if (tape_pages[i].state == PAGE_COMPRESSED) {
+	    compressed++;
+	    if (tape_pages[i].size == 0) zero++;
+	    kept += tape_pages[i].size;
+	}
+	if (tape_pages[i].state != PAGE_HOT) warm_page(i);
+    }
+    free_released();
+    tape_page_count = 0;
+    signal(SIGSEGV, SIG_DFL);
+
+    fprintf(stderr, "COMPRESSED: %lu of %lu pages were compressed at halt (%lu of them zero pages, the rest in %lu KB), after %lu faults\n",
+	    compressed, _MAIN * sizeof(BLOCK) / PAGE_SIZE, zero, (kept + 1023) / 1024, compress_faults);
+#endif
+}
+
+/*
+DEBUGGER
+********
+
+Running a program with the "-debug" flag stops it at "main", and opens a simple
+command prompt (type "help" for the list of commands).
+
+Breakpoints are set by swapping the instruction of the target cell with I_TRAP,
+and keeping the original instruction in the breakpoint table. Cells without a
+breakpoint therefore run at full speed, since run() does no extra checks for
+the debugger. When the machine hits a trap, the original instruction is swapped
+back in for just the one step that executes it.
+*/
+
+#define MAX_BREAKPOINTS 256
+
+typedef struct {
+    DWORD addr;
+    INSTRUCTION ins; // the instruction replaced by I_TRAP
+} BREAKPOINT;
+
+static BREAKPOINT breakpoints[MAX_BREAKPOINTS];
+static int breakpoint_count = 0;
+int debug = 0; // whether to run the program under the debugger
+
+int find_breakpoint(DWORD addr)
+{
+    for (int i = 0; i < breakpoint_count; i++) {
+	if (breakpoints[i].addr == addr) return i;
+    }
+    return -1;
+}
+
+// the instruction at an address (as it would be without breakpoints)
+INSTRUCTION original_instruction(DWORD addr)
+{
+    int i = find_breakpoint(addr);
+    return i >= 0 ? breakpoints[i].ins : tape[addr].ins;
+}
+
+// put the original instructions back in place of the traps
+void disarm_breakpoints()
+{
+    for (int i = 0; i < breakpoint_count; i++) tape[breakpoints[i].addr].ins = breakpoints[i].ins;
+}
+
+// put the traps back (after the tape was rewritten)
+void arm_breakpoints()
+{
+    for (int i = 0; i < breakpoint_count; i++) {
+	if (tape[breakpoints[i].addr].ins != I_TRAP) breakpoints[i].ins = tape[breakpoints[i].addr].ins;
+	tape[breakpoints[i].addr].ins = I_TRAP;
+    }
+}
+
+// execute the instruction at _ptr.pos even if it holds a breakpoint
+int execute_original()
+{
+    int i = find_breakpoint(_ptr.pos);
+    if (i < 0) return execute();
+
+    DWORD addr = _ptr.pos;
+    tape[addr].ins = breakpoints[i].ins;
+    int is_halted = execute();
+    tape[addr].ins = I_TRAP;
+    return is_halted;
+}
+
+// execute a single step (counted the same way as in run())
+int debug_step()
+{
+    if (execute_original()) return 1;
+
+    steps++;
+    if ((steps & safe_point_mask) == 0) safe_point();
+    return 0;
+}
+
+// travel to a step: backwards by restoring a checkpoint, then forwards by executing
+// (returns 1 if the program halted before reaching it)
+int travel_to(DWORD target)
+{
+    if (steps > output_shown_until) output_shown_until = steps;
+    if (target < steps) restore_checkpoint(target);
+
+    while (steps < target) {
+	if (debug_step()) return 1;
+    }
+    return 0;
+}
+
+// travel back to the last step before the current one that reached a breakpoint
+// (or to the start, if there is none)
+int reverse_continue()
+{
+    if (steps > output_shown_until) output_shown_until = steps;
+    DWORD until = steps;
+
+    while (until > 0) {
+	restore_checkpoint(until - 1);
+	DWORD from = steps;
+	long found = -1;
 
-	    map_insert(label_to_address_map, label, _ptr.pos);
-	    continue;
+	while (steps < until) {
+	    if (find_breakpoint(_ptr.pos) >= 0) found = steps;
+	    if (debug_step()) break;
 	}
 
-	DWORD a1, a2;
-	BYTE data_type = 0;
-	int deref_1 = 0, deref_2 = 0;
-	size_t first_len = strlen(first);
+	if (found >= 0) return travel_to(found);
+	until = from;
+    }
+    return travel_to(0);
+}
 
-	if (first[0] == '0' && first[1] == 'x') {
-	    a1 = strtoul(first, NULL, 16);
-	} else if (first[0] == '[' && first[1] == '0' && first[2] == 'x' && first[first_len - 1] == ']') {
-	    // mark the first address for dereferencing
-	    deref_1 = 1;
+// resolve a breakpoint location: an address (0x...), a source line, or a label
+int resolve_location(const char *location, DWORD *addr)
+{
+    if (location[0] == '0' && location[1] == 'x') {
+	*addr = strtoul(location, NULL, 16);
+	return *addr >= _MAIN && *addr <= _END;
+    }
 
-	    char *addr_contained = malloc(first_len - 1);
-	    strncpy(addr_contained, first + 1, first_len - 2); // get the number without the square brackets
-	    addr_contained[first_len - 2] = '\0';
+    if (location[0] >= '0' && location[0] <= '9') {
+	int line = atoi(location);
 
-	    a1 = strtoul(addr_contained, NULL, 16);
-	} else if (first_len > 0) {
-	    // label handling (for the case of "call" instruction)
-	    DWORD *retrieved_addr = map_get(label_to_address_map, first);
-	    if (retrieved_addr == NULL) {
-		fprintf(stderr, "ERROR: Undefined label encountered [Line %d]", line_num);
-		exit(1);
+	// the first cell assembled from the line (or from the closest line after it)
+	int best_line = 0;
+	for (DWORD i = 0; i < INSTR_SIZE; i++) {
+	    if (source_line[i] >= line && (best_line == 0 || source_line[i] < best_line)) {
+		best_line = source_line[i];
+		*addr = _MAIN + i;
 	    }
+	}
+	return best_line != 0;
+    }
+
+    // (a routine folded away by -O keeps its label, but not an address)
+    DWORD *label_addr = map_get(label_to_address_map, location);
+    if (label_addr == NULL) return 0;
+    *addr = *label_addr;
+    return *addr >= _MAIN && *addr <= _END;
+}
+
+// print a cell of the tape
+void print_cell(DWORD addr)
+{
+    INSTRUCTION ins = original_instruction(addr);
+    const char *name = ins < sizeof(instruction_names) / sizeof(instruction_names[0]) ? instruction_names[ins] : "?";
+
+    printf("0x%08lx  %-8s 0x%08lx  %u", addr, name, tape[addr].data, tape[addr].dtype);
+    if (tape[addr].dtype == 1 && tape[addr].data >= 32 && tape[addr].data < 127) printf("  '%c'", (char)tape[addr].data);
+    if (tape[addr].dtype == T_FLOAT) printf("  %g", as_float(tape[addr].data));
+    if (tape[addr].dtype == T_INT) printf("  %ld", (long)tape[addr].data);
+    printf("\n");
+}
+
+// print where the machine currently is
+void print_location()
+{
+    const char *label = map_find_enclosing(label_to_address_map, _ptr.pos);
+
+    printf("[step %lu] %s", steps, label ? label : "?");
+    if (label != NULL) printf("+%lu", _ptr.pos - *map_get(label_to_address_map, label));
+    if (_ptr.pos >= _MAIN && _ptr.pos <= _END && source_line[_ptr.pos - _MAIN]) printf(" [Line %d]", source_line[_ptr.pos - _MAIN]);
+    printf("\n    ");
+    print_cell(_ptr.pos);
+}
+
+void print_debug_help()
+{
+    printf("Commands:\n"
+	   "    b <LOCATION>       set a breakpoint (LOCATION is a label, a source line, or a 0x address)\n"
+	   "    d <LOCATION>       delete a breakpoint\n"
+	   "    l                  list the breakpoints\n"
+	   "    s [N]              execute N steps (1 by default)\n"
+	   "    c                  continue until the next breakpoint\n"
+	   "    rs [N]             step N steps (1 by default) backwards\n"
+	   "    rc                 continue backwards until the previous breakpoint\n"
+	   "    g <STEP>           go to a step (backwards or forwards)\n"
+	   "    p <ADDR> [N]       print N cells (1 by default) starting from ADDR\n"
+	   "    w <ADDR>           report every write to the cell at ADDR\n"
+	   "    r                  print the registers and the tape pointer\n"
+	   "    bt                 print the call stack\n"
+	   "    q                  quit\n");
+}
+
+// read and execute debugger commands (returns 1 if the program halted while stepping)
+int debug_prompt()
+{
+    char line[256];
+
+    while (1) {
+	printf("(tasm) ");
+	fflush(stdout);
+	if (fgets(line, sizeof(line), stdin) == NULL) exit(0);
+
+	char command[16] = "", arg1[128] = "", arg2[128] = "";
+	sscanf(line, "%15s %127s %127s", command, arg1, arg2);
+	if (command[0] == '\0') continue;
+
+	if (strcmp(command, "c") == 0) return 0;
+
+	if (strcmp(command, "q") == 0) exit(0);
 
-	    a1 = *retrieved_addr;
+	if (strcmp(command, "s") == 0) {
+	    long count = arg1[0] ? strtol(arg1, NULL, 0) : 1;
+	    for (long i = 0; i < count; i++) {
+		if (debug_step()) return 1;
+	    }
+	    print_location();
+	    continue;
 	}
 
-        size_t len = strlen(second);
+	if (strcmp(command, "rs") == 0 || strcmp(command, "rc") == 0 || strcmp(command, "g") == 0) {
+	    DWORD count = arg1[0] ? strtoul(arg1, NULL, 0) : 1;
+	    int halted;
 
-	if (second[0] == '"') { // for char / string data
-            if (len > 1 && second[len - 1] == '"') second[len - 1] = '\0';
+	    if (command[0] == 'g') halted = travel_to(count);
+	    else if (command[1] == 'c') halted = reverse_continue();
+	    else halted = travel_to(count > steps ? 0 : steps - count);
 
-	    for (int i = 1; i < len - 1; i++) {
-		a2 = (DWORD)(second[i]);
-		data_type = 1;
+	    if (halted) return 1;
+	    print_location();
+	    continue;
+	}
+
+	if (strcmp(command, "b") == 0 || strcmp(command, "d") == 0) {
+	    DWORD addr;
+	    if (!resolve_location(arg1, &addr)) {
+		printf("Unknown location \"%s\"\n", arg1);
+		continue;
+	    }
 
-		load_instruction(ins, a1, a2, data_type, deref_1, deref_2);
-		a1++;
+	    int i = find_breakpoint(addr);
+	    if (command[0] == 'b' && i < 0) {
+		if (breakpoint_count == MAX_BREAKPOINTS) {
+		    printf("Too many breakpoints\n");
+		    continue;
+		}
+		breakpoints[breakpoint_count].addr = addr;
+		breakpoints[breakpoint_count].ins = tape[addr].ins;
+		breakpoint_count++;
+		tape[addr].ins = I_TRAP;
+	    } else if (command[0] == 'd' && i >= 0) {
+		tape[addr].ins = breakpoints[i].ins;
+		breakpoints[i] = breakpoints[--breakpoint_count];
 	    }
+	    printf("Breakpoint %s at 0x%08lx\n", command[0] == 'b' ? "set" : "deleted", addr);
 	    continue;
-	} else if (second[0] == '[' && second[len - 1] == ']') { // for unsigned int address enclosed in []
-	    // mark the second address for dereferencing
-	    deref_2 = 1;
+	}
 
-	    char *addr_contained = malloc(len - 1);
-	    strncpy(addr_contained, second + 1, len - 2); // get the number without the square brackets
-	    addr_contained[len - 2] = '\0';
+	if (strcmp(command, "l") == 0) {
+	    for (int i = 0; i < breakpoint_count; i++) print_cell(breakpoints[i].addr);
+	    continue;
+	}
 
-	    a2 = strtoul(addr_contained, NULL, 0);
-	} else if (len > 0) { // for unsigned int data (hex / oct / dec)
-            a2 = strtoul(second, NULL, 0);
+	if (strcmp(command, "p") == 0) {
+	    DWORD addr = cell_address(arg1, NULL);
+	    long count = arg2[0] ? strtol(arg2, NULL, 0) : 1;
+	    for (long i = 0; i < count && addr + i <= _END; i++) print_cell(addr + i);
+	    continue;
+	}
+
+	if (strcmp(command, "w") == 0) {
+	    DWORD addr = cell_address(arg1, NULL);
+	    if (add_watchpoint(addr)) printf("Watching 0x%lx\n", addr);
+	    continue;
+	}
+
+	if (strcmp(command, "r") == 0) {
+	    printf("_ptr   pos 0x%08lx  data 0x%08lx  dtype %u\n", _ptr.pos, _ptr.data, _ptr.dtype);
+	    printf("_TEMP  0x%08lx\n_ZF    %lu\n_CF    %lu\n", tape[_TEMP].data, tape[_ZF].data, tape[_CF].data);
+	    printf("_SF    %lu\n_OF    %lu\n", tape[_SF].data, tape[_OF].data);
+	    printf("_DISP  0x%08lx\n_STK   0x%08lx\n", tape[_DISP].data, tape[_STK].data);
+	    continue;
+	}
+
+	if (strcmp(command, "bt") == 0) {
+	    print_stack_trace(stdout);
+	    continue;
 	}
 
-	load_instruction(ins, a1, a2, data_type, deref_1, deref_2);
+	print_debug_help();
     }
-    // add halt at the end for safety
-    tape[_ptr.pos].ins = I_HALT;
-    tape[_ptr.pos].data = 0;
+}
 
-    // set the pointer position to the main label
-    DWORD *main_addr = map_get(label_to_address_map, "main");
-    if (main_addr == NULL) {
-	fprintf(stderr, "ERROR: Could not find \"main\"");
-	exit(1);
+// called by run() when it reaches a breakpoint
+int debug_trap()
+{
+    printf("Breakpoint hit ");
+    print_location();
+
+    if (debug_prompt()) return 1;
+
+    // this step is counted by run()
+    return execute_original();
+}
+
+// stop at the end of the program, where it can still be stepped backwards
+// (returns 1 if the program should continue running)
+int debug_halted()
+{
+    while (1) {
+	printf("Program halted after %lu steps\n", steps);
+	if (debug_prompt()) continue;
+	return original_instruction(_ptr.pos) != I_HALT;
     }
-    _ptr.pos = *main_addr;
+}
 
-    // set the initial addresses in the flags
-    tape[_DISP].data = _OUT;
-    tape[_STK].data = _STACK;
+// stop at main before running the program (returns 1 if it halted while stepping)
+int debug_start()
+{
+    printf("TASM debugger (type \"help\" for the list of commands)\nStopped at ");
+    print_location();
 
-    fclose(tasm_file);
+    if (debug_prompt()) return 1;
+    return debug_step();
 }
 
-// output display text
-void output()
+/*
+HOT RELOAD
+**********
+
+Running with "-reload" lets a long-running program pick up changes to its source without
+being restarted (and so without losing its memory). Sending SIGHUP to the machine requests
+a reload: the signal handler only sets a flag, and at the next safe point every label is
+armed, by swapping the instruction of its cell with I_RELOAD (the way breakpoints are set).
+The next time the program reaches a label, all of them are disarmed, and:
+
+    (1) the source is first assembled by a separate "tasm <FILE> -check" process, so that
+	a source with errors leaves the running program as it is
+    (2) instruction memory is cleared, and the source is assembled into it again. Storage,
+	stack and display memory are kept, and so are the registers and _ptr.data. Variables
+	keep their cells (as long as their size is the same), and new variables are placed
+	after all the old ones
+    (3) the position moves to the same label in the new program, and every return address
+	on the stack to the same call: the N-th call to the same label, after the label
+	enclosing it
+
+If a position cannot be found in the new program (its label, or call, is gone), the old
+program is put back, and keeps running. Either way, the outcome is reported on stderr.
+
+Cells of storage that hold instruction addresses (other than the stack) are not moved.
+Programs with coroutines cannot be reloaded, and -reload cannot be combined with -O, -debug,
+-parallel, -record, -replay or -state. (Only on POSIX systems.)
+*/
+
+typedef struct {
+    DWORD addr;
+    INSTRUCTION ins; // the instruction replaced by I_RELOAD
+} RELOAD_POINT;
+
+static const char *reload_program = NULL; // the tasm executable (to check the new source with)
+static RELOAD_POINT *reload_points = NULL;
+static int reload_point_count = 0;
+
+void reload_disarm()
 {
-    DWORD final_addr = _ptr.pos + 1;
-    _ptr.pos = _OUT;
-    int is_escaped = 0;
+    for (int i = 0; i < reload_point_count; i++) tape[reload_points[i].addr].ins = reload_points[i].ins;
+    reload_point_count = 0;
+}
 
-    while (_ptr.pos < _OUT_END && _ptr.pos < tape[_DISP].data) {
-	DWORD val = tape[_ptr.pos].data;
+#ifdef TASM_POSIX
+static volatile sig_atomic_t reload_requested = 0;
 
-	// handle escape sequences
-	if (is_escaped) {
-	    if (val == (DWORD)'n') putchar('\n');
-	    else if (val == (DWORD)'r') putchar('\r');
+void request_reload(int sig)
+{
+    (void)sig;
+    reload_requested = 1;
+}
 
-	    is_escaped = 0;
-	    _ptr.pos++;
-	    continue;
+// set a reload point at every label (called at a safe point, once a reload is requested)
+void reload_arm()
+{
+    if (!reload_requested || reload_point_count > 0) return;
+    reload_requested = 0;
+
+    if (stack_floor != _STACK_END) {
+	fprintf(stderr, "RELOAD: Programs with coroutines cannot be reloaded\n");
+	return;
+    }
+
+    for (int i = 0; i < STACK_SIZE; i++) {
+	for (Pair *curr = label_to_address_map[i]; curr != NULL; curr = curr->next) {
+	    DWORD addr = curr->value;
+	    if (addr < _MAIN || addr > _END || tape[addr].ins == I_RELOAD) continue;
+
+	    reload_points = realloc(reload_points, sizeof(RELOAD_POINT) * (reload_point_count + 1));
+	    reload_points[reload_point_count].addr = addr;
+	    reload_points[reload_point_count].ins = tape[addr].ins;
+	    reload_point_count++;
+	    tape[addr].ins = I_RELOAD;
 	}
+    }
+}
+#endif
 
-	// if dtype is 1, treat like a char
-	if (tape[_ptr.pos].dtype) {
-	    if (val == (DWORD)'\\') {
-		is_escaped = 1;
-		_ptr.pos++;
-		continue;
-	    }
-	    putchar((char) (val & 0xFF));
-	} else printf("%lu", val);
+// whether the source assembles (checked by another process, as the assembler exits on errors)
+int reload_check()
+{
+#ifdef TASM_POSIX
+    pid_t pid = fork();
+    if (pid == 0) {
+	execlp(reload_program, reload_program, reload_file, "-check", (char *)NULL);
+	_exit(127);
+    }
 
-	is_escaped = 0;
-	_ptr.pos++;
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid) return 0;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#else
+    return 0;
+#endif
+}
+
+void map_free(Pair **map)
+{
+    for (int i = 0; i < STACK_SIZE; i++) {
+	while (map[i] != NULL) {
+	    Pair *next = map[i]->next;
+	    free(map[i]->key);
+	    free(map[i]);
+	    map[i] = next;
+	}
     }
-    _ptr.pos = final_addr;
 }
 
-// run the program on the turing machine (tape)
-// (contains all instruction implementations)
-void run()
+// the new address of the code that follows the old labels at addr (0 if they are all gone,
+// or there are none), which is after the last of them, as they may not be together anymore
+DWORD reload_label(Pair **old_labels, DWORD addr, int *is_label)
 {
-    int is_halted = 0;
+    DWORD new_addr = 0;
+    *is_label = 0;
 
-    while (!is_halted)
-    {
-	if (_ptr.pos > _END) {
-	    fprintf(stderr, "RUNTIME ERROR: Memory out of bounds. Address 0x%lx [%lu] does not exist", _ptr.pos, _ptr.pos);
-	    if (memdump) generate_memory_dump();
-	    exit(1);
+    for (int i = 0; i < STACK_SIZE; i++) {
+	for (Pair *curr = old_labels[i]; curr != NULL; curr = curr->next) {
+	    if (curr->value != addr) continue;
+	    *is_label = 1;
+
+	    DWORD *moved = map_get(label_to_address_map, curr->key);
+	    if (moved != NULL && *moved > new_addr) new_addr = *moved;
 	}
+    }
+    return new_addr;
+}
 
-	DWORD addr = tape[_ptr.pos].data;
-	if (addr > _END) {
-	    fprintf(stderr, "RUNTIME ERROR: Memory out of bounds. Address 0x%lx [%lu] does not exist", addr, addr);
-	    if (memdump) generate_memory_dump();
-	    exit(1);
+// the position in the reloaded program of a label (call = 0), or of a call (call = 1) of the
+// old one, which is found as the N-th call to the same label after its enclosing label
+// (returns 0 if it is gone)
+DWORD reload_position(const BLOCK *old_code, Pair **old_labels, DWORD pos, int call)
+{
+    DWORD start = 0, end = _END + 1;
+    int is_label;
+
+    for (int i = 0; i < STACK_SIZE; i++) {
+	for (Pair *curr = old_labels[i]; curr != NULL; curr = curr->next) {
+	    if (curr->value <= pos && curr->value > start) start = curr->value;
 	}
+    }
+    if (start < _MAIN || (!call && start != pos)) return 0;
 
-	// execute the instruction
-	switch (tape[_ptr.pos].ins) {
-	case I_NONE:
-	    _ptr.pos++;
-	    break;
-	case I_HALT:
-	    is_halted = 1;
-	    break;
-	case I_JUMP:
-	    _ptr.pos = addr;
-	    break;
-	case I_CMP:
-	    tape[_ZF].data = tape[addr].data == _ptr.data;
-	    tape[_CF].data = tape[addr].data < _ptr.data;
-	    _ptr.pos++;
-	    break;
-	case I_JE:
-	    _ptr.pos = tape[_ZF].data == 1 ? addr : _ptr.pos + 1;
-	    break;
-	case I_JNE:
-	    _ptr.pos = tape[_ZF].data == 0 ? addr : _ptr.pos + 1;
-	    break;
-	case I_JG:
-	    _ptr.pos = (tape[_ZF].data == 0 && tape[_CF].data == 0) ? addr : _ptr.pos + 1;
-	    break;
-	case I_JGE:
-	    _ptr.pos = tape[_CF].data == 0 ? addr : _ptr.pos + 1;
-	    break;
-	case I_JL:
-	    _ptr.pos = tape[_CF].data == 1 ? addr : _ptr.pos + 1;
-	    break;
-	case I_JLE:
-	    _ptr.pos = (tape[_ZF].data == 1 || tape[_CF].data == 1) ? addr : _ptr.pos + 1;
-	    break;
-	case I_READ:
-	    _ptr.data = tape[addr].data;
-	    _ptr.dtype = tape[addr].dtype;
-	    _ptr.pos++;
-	    break;
-	case I_WRITE:
-	    tape[addr].data = _ptr.data;
-	    tape[addr].dtype = _ptr.dtype;
-
-	    if (addr >= tape[_DISP].data && addr <= _OUT_END) tape[_DISP].data = addr + 1;
-	    _ptr.pos++;
-	    break;
-	case I_AND:
-	    tape[addr].data &= _ptr.data;
-	    _ptr.pos++;
-	    break;
-	case I_OR:
-	    tape[addr].data |= _ptr.data;
-	    _ptr.pos++;
-	    break;
-	case I_XOR:
-	    tape[addr].data ^= _ptr.data;
-	    _ptr.pos++;
-	    break;
-	case I_NOT:
-	    tape[addr].data = !tape[addr].data;
-	    _ptr.pos++;
-	    break;
-	case I_LSHIFT:
-	    tape[addr].data <<= _ptr.data;
-	    _ptr.pos++;
-	    break;
-	case I_RSHIFT:
-	    tape[addr].data >>= _ptr.data;
-	    _ptr.pos++;
-	    break;
-	case I_ADD:
-	    tape[addr].data += _ptr.data;
-	    _ptr.pos++;
-	    break;
-	case I_SUB:
-	    tape[addr].data -= _ptr.data;
-	    _ptr.pos++;
-	    break;
-	case I_MUL:
-	    tape[addr].data *= _ptr.data;
-	    _ptr.pos++;
-	    break;
-	case I_DIV:
-	    tape[addr].data /= _ptr.data;
-	    _ptr.pos++;
-	    break;
-	case I_OUT:
-	    output();
-	    break;
-	case I_CALL:
-	    if (tape[_STK].data < _STACK_END) {
-		fprintf(stderr, "RUNTIME ERROR: Stack overflow occurred. Execution terminated.");
-		if (memdump) generate_memory_dump();
-		exit(1);
-	    }
-	    tape[tape[_STK].data].data = _ptr.pos + 1;
-	    tape[_STK].data--;
-	    _ptr.pos = addr;
-	    break;
-	case I_RET:
-	    tape[_STK].data++;
-	    _ptr.pos = tape[tape[_STK].data].data;
-	    break;
-	default:
-	    fprintf(stderr, "RUNTIME ERROR: Invalid instruction :: %u", tape[_ptr.pos].ins);
-	    if (memdump) generate_memory_dump();
-	    exit(1);
+    DWORD new_start = reload_label(old_labels, start, &is_label);
+    if (new_start == 0 || !call) return new_start;
+    if (old_code[pos - _MAIN].ins != I_CALL) return 0;
+
+    // (calls through a pointer, or to an address, are only counted among all the calls)
+    DWORD target = old_code[pos - _MAIN].data;
+    DWORD new_target = reload_label(old_labels, target, &is_label);
+    if (is_label && new_target == 0) return 0;
+
+    DWORD nth = 0;
+    for (DWORD i = start; i < pos; i++) {
+	if (old_code[i - _MAIN].ins == I_CALL && (!is_label || old_code[i - _MAIN].data == target)) nth++;
+    }
+
+    for (int i = 0; i < STACK_SIZE; i++) {
+	for (Pair *curr = label_to_address_map[i]; curr != NULL; curr = curr->next) {
+	    if (curr->value > new_start && curr->value < end) end = curr->value;
+	}
+    }
+    for (DWORD i = new_start; i < end; i++) {
+	if (tape[i].ins == I_CALL && (!is_label || tape[i].data == new_target) && nth-- == 0) return i;
+    }
+    return 0;
+}
+
+// reassemble the program, and move the running one over to it (returns 0 if it is kept)
+int reload_tasm()
+{
+    if (!reload_check()) {
+	fprintf(stderr, "\nRELOAD: %s could not be assembled, the running program is kept\n", reload_file);
+	return 0;
+    }
+
+    // the running program, to translate its positions (and to be put back, if that fails)
+    BLOCK *old_code = malloc(INSTR_SIZE * sizeof(BLOCK));
+    int *old_lines = malloc(INSTR_SIZE * sizeof(int));
+    Pair *old_labels[STACK_SIZE], *old_variable_map[STACK_SIZE];
+    memcpy(old_code, &tape[_MAIN], INSTR_SIZE * sizeof(BLOCK));
+    memcpy(old_lines, source_line, INSTR_SIZE * sizeof(int));
+    memcpy(old_labels, label_to_address_map, sizeof(old_labels));
+    memcpy(old_variable_map, variable_map, sizeof(old_variable_map));
+    kept_variables = variables;
+    kept_count = variable_count;
+    int old_forward_labels = forward_labels;
+
+    TAPE_PTR ptr = _ptr;
+    BLOCK disp = tape[_DISP], stk = tape[_STK];
+
+    variables = NULL;
+    variable_count = 0;
+    forward_labels = 0;
+    asm_count = 0;
+    memset(&tape[_MAIN], 0, INSTR_SIZE * sizeof(BLOCK));
+    memset(source_line, 0, INSTR_SIZE * sizeof(int));
+    assemble_tasm(reload_file);
+
+    _ptr = ptr;
+    tape[_DISP] = disp;
+    tape[_STK] = stk;
+
+    // the new positions (of the label reached, and of the calls on the stack)
+    DWORD depth = _STACK - stk.data, moved = 0;
+    DWORD *returns = malloc(sizeof(DWORD) * (depth + 1));
+    DWORD pos = stack_floor == _STACK_END ? reload_position(old_code, old_labels, ptr.pos, 0) : 0;
+    for (DWORD i = 0; pos != 0 && i < depth; i++) {
+	DWORD call = reload_position(old_code, old_labels, tape[stk.data + 1 + i].data - 1, 1);
+	if (call == 0) pos = 0;
+	returns[i] = call + 1;
+    }
+
+    const char *label = map_find_enclosing(old_labels, ptr.pos);
+    if (pos == 0) {
+	// put the running program back
+	map_free(label_to_address_map);
+	map_free(variable_map);
+	for (int i = 0; i < variable_count; i++) free(variables[i].name);
+	free(variables);
+	memcpy(&tape[_MAIN], old_code, INSTR_SIZE * sizeof(BLOCK));
+	memcpy(source_line, old_lines, INSTR_SIZE * sizeof(int));
+	memcpy(label_to_address_map, old_labels, sizeof(old_labels));
+	memcpy(variable_map, old_variable_map, sizeof(old_variable_map));
+	variables = kept_variables;
+	variable_count = kept_count;
+	forward_labels = old_forward_labels;
+	stack_floor = _STACK_END;
+
+	fprintf(stderr, "RELOAD: The position at \"%s\" (or a call on the stack) is not in the new program, the running program is kept\n",
+		label ? label : "?");
+    } else {
+	for (DWORD i = 0; i < depth; i++) {
+	    if (tape[stk.data + 1 + i].data != returns[i]) moved++;
+	    tape[stk.data + 1 + i].data = returns[i];
+	}
+	_ptr.pos = pos;
+
+	fprintf(stderr, "RELOAD: Reloaded %s at step %lu, at \"%s\" (%lu of %lu return addresses moved)\n",
+		reload_file, steps, label ? label : "?", moved, depth);
+	map_free(old_labels);
+	map_free(old_variable_map);
+	for (int i = 0; i < kept_count; i++) free(kept_variables[i].name);
+	free(kept_variables);
+    }
+
+    kept_variables = NULL;
+    kept_count = 0;
+    free(returns);
+    free(old_lines);
+    free(old_code);
+    return pos != 0;
+}
+
+// called by run() when it reaches a reload point
+int reload_trap()
+{
+    reload_disarm();
+    if (reload_file != NULL) reload_tasm();
+
+    // this step is counted by run()
+    return execute();
+}
+
+/*
+VM FORKS
+********
+
+"vfork <ADDR>" clones the whole machine with fork(), so the clone shares the pages of the tape
+with the original until either of them writes to one (copy-on-write). The clone continues
+right after the vfork with 1 in ADDR, and the original with 0, so a search can try a branch
+in a clone without saving and restoring the cells it changes.
+
+A clone ends with "vexit <ADDR>", which hands the cell at ADDR (its data and dtype) back to
+the original through a pipe. "vjoin <ADDR>" waits for the oldest clone that has not been
+joined yet, and sets its result to ADDR. So the results always come back in the order of the
+vforks, however the clones are scheduled. A clone that halts without a vexit gives 0.
+(In the original machine, vexit simply halts.)
+
+Clones run with the debugger, watchpoints, recording, state traces and statistics turned off,
+and their "out" prints nothing, so that only the original machine has any effect outside.
+Clones that are never joined are killed when the original machine exits.
+*/
+
+#define VM_MAX_CLONES 256 // clones not yet joined (per machine)
+
+typedef struct {
+    pid_t pid;
+    int fd; // (the read end of the pipe from the clone)
+} VM_CLONE;
+
+static VM_CLONE vm_clones[VM_MAX_CLONES];
+static int vm_clone_count = 0;
+static int vm_result_fd = -1; // the write end of the pipe to the original (in a clone)
+
+// kill the clones that were never joined
+void vm_abandon_clones()
+{
+#ifdef TASM_POSIX
+    for (int i = 0; i < vm_clone_count; i++) {
+	kill(vm_clones[i].pid, SIGKILL);
+	waitpid(vm_clones[i].pid, NULL, 0);
+	close(vm_clones[i].fd);
+    }
+    vm_clone_count = 0;
+#endif
+}
+
+DWORD vm_fork()
+{
+#ifdef TASM_POSIX
+    if (vm_clone_count == VM_MAX_CLONES) {
+	fprintf(stderr, "RUNTIME ERROR: Too many clones of the machine (at most %d can be waiting to be joined)", VM_MAX_CLONES);
+	if (memdump) generate_memory_dump();
+	exit(1);
+    }
+
+    int fds[2];
+    fflush(NULL); // (so that the buffered output is not written twice)
+    sink_flush();
+    if (pipe(fds) != 0) {
+	fprintf(stderr, "RUNTIME ERROR: Failed to clone the machine (pipe failed)");
+	if (memdump) generate_memory_dump();
+	exit(1);
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+	fprintf(stderr, "RUNTIME ERROR: Failed to clone the machine (fork failed)");
+	if (memdump) generate_memory_dump();
+	exit(1);
+    }
+
+    if (pid == 0) {
+	close(fds[0]);
+	for (int i = 0; i < vm_clone_count; i++) close(vm_clones[i].fd);
+	vm_clone_count = 0;
+	if (vm_result_fd >= 0) close(vm_result_fd);
+	vm_result_fd = fds[1];
+
+	// (the clone only hands back its result)
+	disarm_breakpoints();
+	breakpoint_count = 0;
+	unprotect_watched_pages();
+	watchpoint_count = 0;
+	debug = 0;
+	record_file = NULL;
+	keep_checkpoints = 0;
+	keep_inputs = 0;
+	if (replaying) {
+	    input_count = input_cursor;
+	    replaying = 0;
 	}
+	state_file = NULL;
+	state_every = 0;
+	stats = NULL;
+	memdump = 0;
+	output_shown_until = ~0UL;
+	if (batch_size != NULL) memset(batch_size, 0, INSTR_SIZE); // (the worker threads are not cloned)
+	reload_disarm();
+	reload_file = NULL;
+	return 1;
+    }
+
+    close(fds[1]);
+    if (vm_clone_count == 0) atexit(vm_abandon_clones);
+    vm_clones[vm_clone_count].pid = pid;
+    vm_clones[vm_clone_count].fd = fds[0];
+    vm_clone_count++;
+    return 0;
+#else
+    fprintf(stderr, "RUNTIME ERROR: vfork is not supported on this platform");
+    exit(1);
+#endif
+}
+
+BLOCK vm_join()
+{
+    BLOCK result = { I_NONE, 0, T_UINT };
+#ifdef TASM_POSIX
+    if (vm_clone_count == 0) {
+	fprintf(stderr, "RUNTIME ERROR: vjoin without a clone to join");
+	if (memdump) generate_memory_dump();
+	exit(1);
+    }
+
+    VM_CLONE clone = vm_clones[0];
+    memmove(vm_clones, vm_clones + 1, sizeof(VM_CLONE) * --vm_clone_count);
+
+    DWORD message[2];
+    ssize_t got = read(clone.fd, message, sizeof(message));
+    close(clone.fd);
+
+    int status = 0;
+    waitpid(clone.pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+	fprintf(stderr, "RUNTIME ERROR: A clone of the machine failed");
+	if (memdump) generate_memory_dump();
+	exit(1);
+    }
+
+    if (got == sizeof(message)) {
+	result.data = message[0];
+	result.dtype = (BYTE)message[1];
+    }
+#endif
+    return result;
+}
+
+// end the machine if it is a clone, handing back the result (if there is one)
+void vm_exit(const BLOCK *result)
+{
+#ifdef TASM_POSIX
+    if (vm_result_fd < 0) return;
+
+    if (result != NULL) {
+	DWORD message[2] = { result->data, result->dtype };
+	if (write(vm_result_fd, message, sizeof(message)) != sizeof(message)) _exit(1);
     }
+    _exit(0); // skip the exit handlers of the original
+#else
+    (void)result;
+#endif
+}
+
+/*
+EXECUTION ENGINES
+*****************
+
+run() is the reference engine. The others must behave exactly the same way
+(which tools/tasm-diff.c checks), and are selected with "-engine <NAME>".
+*/
+
+// execute one step at a time, through the same path as the debugger
+void run_stepwise()
+{
+    while (!debug_step());
 }
 
+typedef struct {
+    const char *name;
+    void (*run)();
+} ENGINE;
+
+static const ENGINE engines[] = {
+    { "switch", run },
+    { "step", run_stepwise },
+};
+
 // check the extension of a file (ext is to be passed without a dot)
 int has_extension(const char *file_name, const char *ext) {
     const char *dot = strrchr(file_name, '.');
@@ -913,18 +5252,161 @@ int has_extension(const char *file_name, const char *ext) {
     return strcmp(dot + 1, ext) == 0;
 }
 
-void main(int argc, char** argv)
+int main(int argc, char** argv)
 {
+    char *watch_list = NULL;
+    const char *record_log = NULL, *replay_log = NULL;
+    const char *engine_name = "switch", *state_name = NULL, *fb_size = NULL, *output_name = NULL, *emit_list = NULL;
+    DWORD every = 0;
+    int parallel = 0, check = 0;
+
+    // list the engines (for tools/tasm-diff.c)
+    if (argc == 2 && strcmp(argv[1], "-engines") == 0) {
+	for (size_t i = 0; i < sizeof(engines) / sizeof(ENGINE); i++) printf("%s\n", engines[i].name);
+	return 0;
+    }
+
     if (argc < 2 || !has_extension(argv[1], "tasm")) {
 	fprintf(stderr, "ERROR: Provide the .tasm file name in the argument");
 	exit(1);
     }
 
-    // flag for memory dump files to be generated after execution in complete
-    memdump = (argc > 2 && strcmp(argv[2], "-memdump") == 0);
+    for (int i = 2; i < argc; i++) {
+	if (strcmp(argv[i], "-memdump") == 0) memdump = 1; // memory dump files to be generated after execution in complete
+	else if (strcmp(argv[i], "-bench") == 0) bench = 1; // measurements to be reported after execution is complete
+	else if (strcmp(argv[i], "-debug") == 0) debug = 1; // program to be run under the debugger
+	else if (strcmp(argv[i], "-watch") == 0 && i + 1 < argc) watch_list = argv[++i]; // cells to watch
+	else if (strcmp(argv[i], "-record") == 0 && i + 1 < argc) record_log = argv[++i]; // log to record the inputs into
+	else if (strcmp(argv[i], "-replay") == 0 && i + 1 < argc) replay_log = argv[++i]; // log to replay the inputs from
+	else if (strcmp(argv[i], "-O") == 0) optimize = 1; // optimize the program
+	else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) output_name = argv[++i]; // file to write the output into
+	else if (strcmp(argv[i], "-fb") == 0 && i + 1 < argc) fb_size = argv[++i]; // display memory as a framebuffer
+	else if (strcmp(argv[i], "-engine") == 0 && i + 1 < argc) engine_name = argv[++i]; // engine to run the program with
+	else if (strcmp(argv[i], "-state") == 0 && i + 1 < argc) state_name = argv[++i]; // file to write state hashes into
+	else if (strcmp(argv[i], "-state-every") == 0 && i + 1 < argc) every = strtoul(argv[++i], NULL, 0); // steps between state hashes
+	else if (strcmp(argv[i], "-parallel") == 0) parallel = 1; // run independent calls on worker threads
+	else if (strcmp(argv[i], "-compress") == 0) compress = 1; // compress the cold pages of the tape
+	else if (strcmp(argv[i], "-reload") == 0) reload_file = argv[1]; // reassemble the program on SIGHUP
+	else if (strcmp(argv[i], "-check") == 0) check = 1; // only assemble the program
+	else if (strcmp(argv[i], "-emit-cells") == 0 && i + 1 < argc) emit_list = argv[++i]; // cells to write out at halt
+	else if (strcmp(argv[i], "-emit-format") == 0 && i + 1 < argc) { // format to write them in
+	    i++;
+	    for (emit_format = 0; emit_format < 3 && strcmp(argv[i], emit_extensions[emit_format]) != 0; emit_format++);
+	    if (emit_format == 3) {
+		fprintf(stderr, "ERROR: Unknown format \"%s\" (json, csv or bin)", argv[i]);
+		exit(1);
+	    }
+	}
+	else {
+	    fprintf(stderr, "ERROR: Unknown flag \"%s\"", argv[i]);
+	    exit(1);
+	}
+    }
+
+    const ENGINE *engine = NULL;
+    for (size_t i = 0; i < sizeof(engines) / sizeof(ENGINE); i++) {
+	if (strcmp(engines[i].name, engine_name) == 0) engine = &engines[i];
+    }
+    if (engine == NULL) {
+	fprintf(stderr, "ERROR: Unknown engine \"%s\"", engine_name);
+	exit(1);
+    }
+
+    if (compress && (watch_list != NULL || parallel)) {
+	fprintf(stderr, "ERROR: -compress cannot be combined with -watch or -parallel");
+	exit(1);
+    }
+
+    void (*run_program)() = engine->run;
+    if (parallel) {
+#ifdef TASM_POSIX
+	if (debug || watch_list != NULL || record_log != NULL || replay_log != NULL || state_name != NULL || engine != &engines[0]) {
+	    fprintf(stderr, "ERROR: -parallel cannot be combined with -debug, -watch, -record, -replay, -state or -engine");
+	    exit(1);
+	}
+	run_program = run_parallel;
+#else
+	fprintf(stderr, "ERROR: -parallel is not supported on this platform");
+	exit(1);
+#endif
+    }
+
+    if (reload_file != NULL) {
+#ifdef TASM_POSIX
+	if (optimize || debug || parallel || record_log != NULL || replay_log != NULL || state_name != NULL) {
+	    fprintf(stderr, "ERROR: -reload cannot be combined with -O, -debug, -parallel, -record, -replay or -state");
+	    exit(1);
+	}
+	reload_program = argv[0];
+#else
+	fprintf(stderr, "ERROR: -reload is not supported on this platform");
+	exit(1);
+#endif
+    }
 
+    DWORD assemble_start = now_ns();
     assemble_tasm(argv[1]);
-    run();
+    if (check) return 0;
+    DWORD assemble_ns = now_ns() - assemble_start;
+
+    // (watched only once the program is loaded)
+    for (char *addr = watch_list; addr != NULL && *addr != '\0'; addr++) {
+	if (!add_watchpoint(cell_address(addr, &addr))) exit(1);
+	if (*addr == '\0') break;
+    }
+    if (emit_list != NULL) parse_emit_cells(emit_list);
+
+#ifdef TASM_POSIX
+    if (parallel) parallel_start();
+#endif
+
+    stats_open(argv[1]);
+
+#ifdef TASM_POSIX
+    struct sigaction snapshot_action = {0};
+    snapshot_action.sa_handler = request_snapshot;
+    snapshot_action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &snapshot_action, NULL);
+
+    if (reload_file != NULL) {
+	struct sigaction reload_action = {0};
+	reload_action.sa_handler = request_reload;
+	reload_action.sa_flags = SA_RESTART;
+	sigaction(SIGHUP, &reload_action, NULL);
+    }
+#endif
+
+    // (the debugger and watchpoints look at steps in between safe points)
+    exact_steps = debug || watch_list != NULL;
+    if (debug) {
+	keep_inputs = 1;
+	keep_checkpoints = 1;
+    }
+    if (replay_log != NULL) start_replay(replay_log);
+    if (record_log != NULL) start_recording(record_log);
+    else if (debug) take_checkpoint();
+
+    if (state_name != NULL) start_state_trace(state_name, every);
+    if (output_name != NULL) sink_open(output_name);
+    if (fb_size != NULL) fb_open(fb_size);
+    if (compress) compress_start();
+
+    DWORD run_start = now_ns();
+    if (!debug || !debug_start()) run_program();
+    while (debug && debug_halted()) run_program();
+    DWORD run_ns = now_ns() - run_start;
+
+    if (compress) compress_stop();
+    if (state_name != NULL) write_final_state(state_name);
+    if (emit_list != NULL) emit_cells();
 
     if (memdump) generate_memory_dump();
+
+    // a single line for tools/tasm-bench to parse
+    if (bench) {
+	fflush(stdout);
+	fprintf(stderr, "BENCH lines=%lu assemble_ns=%lu steps=%lu run_ns=%lu output_bytes=%lu\n",
+		source_lines, assemble_ns, steps, run_ns, output_bytes);
+    }
+    return 0;
 }
@@ -0,0 +1,56 @@
+/*
+    MIT License
+
+    Copyright (c) 2025 Rachit Dhar
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+*/
+
+#ifndef TASM_STATS_H
+#define TASM_STATS_H
+
+/*
+LIVE RUNTIME STATISTICS
+***********************
+
+Every running TASM machine publishes a small block of statistics into a
+POSIX shared memory segment named "/tasm.<PID>" (visible as /dev/shm/tasm.<PID>
+on Linux). The block is rewritten at the safe points of the machine (once
+every SAFE_POINT_INTERVAL steps, see tasm.c), so it can be up to that many
+steps behind.
+
+The tasm-top tool reads these segments to list all live machines on the host.
+
+The writer bumps seq to an odd value before updating the block, and back to
+an even value after it is done. A reader retries until it sees the same even
+seq before and after copying the block out.
+*/
+
+#define TASM_STATS_PREFIX "tasm."   // segment name prefix (without the leading '/')
+#define TASM_STATS_MAGIC 0x5441534DUL // "TASM"
+#define TASM_STATS_NAME_LEN 64
+
+typedef struct {
+    unsigned long magic;
+    volatile unsigned long seq;
+
+    unsigned long pid;
+    unsigned long steps;         // instructions executed so far
+    unsigned long pos;           // current _ptr.pos
+    unsigned long stack_depth;   // number of return addresses on the call stack
+    unsigned long display_fill;  // number of cells used in display memory
+    unsigned long steps_per_sec; // measured over the last interval
+
+    char label[TASM_STATS_NAME_LEN];   // label enclosing _ptr.pos
+    char program[TASM_STATS_NAME_LEN]; // .tasm file being run
+} TASM_STATS;
+
+#endif
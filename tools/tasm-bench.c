@@ -0,0 +1,390 @@
+/*
+    MIT License
+
+    Copyright (c) 2025 Rachit Dhar
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+*/
+
+/*
+TASM-BENCH
+**********
+
+Tracks the performance of tasm.c across versions.
+
+    tasm-bench run <TASM_BINARY> [-rev <REV>] [-n <RUNS>] [-suite <DIR>] [-results <FILE>]
+
+	Runs every .tasm workload in the suite directory (tools/bench by default),
+	plus a generated large source file for the assembler, RUNS times each
+	(5 by default) under the given tasm build with the "-bench" flag.
+	The measured steps/sec, assembled lines/sec and output bytes/sec are
+	appended to the results file (tasm-bench-results.txt by default),
+	keyed by the git revision (the current HEAD by default).
+
+    tasm-bench compare <BASE_REV> [<REV>] [-threshold <PCT>] [-alpha <P>] [-results <FILE>]
+
+	Compares the results of REV (the current HEAD by default) against those
+	of BASE_REV, with Welch's t-test on every metric of every workload.
+	A metric has regressed if it is more than PCT percent slower (5 by default)
+	and the difference is significant at level P (0.05 by default).
+	Exits with status 1 if any metric has regressed.
+
+RESULTS FILE FORMAT (one line per run of a workload):
+
+    <REV> <WORKLOAD> <STEPS_PER_SEC> <LINES_PER_SEC> <OUTPUT_BYTES_PER_SEC>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#define DEFAULT_SUITE "tools/bench"
+#define DEFAULT_RESULTS "tasm-bench-results.txt"
+#define DEFAULT_RUNS 5
+#define LARGE_SOURCE_LINES 45000 // 2 cells per line, within instruction memory
+
+// below these amounts, a metric is too noisy to be worth recording (it is stored as 0)
+#define MIN_STEPS 1000000
+#define MIN_LINES 1000
+#define MIN_OUTPUT_BYTES 1000000
+
+#define MAX_SAMPLES 100000
+#define NAME_LEN 128
+#define METRIC_COUNT 3
+
+static const char *metric_names[METRIC_COUNT] = { "steps/sec", "lines/sec", "output bytes/sec" };
+
+typedef struct {
+    char rev[NAME_LEN];
+    char workload[NAME_LEN];
+    double metrics[METRIC_COUNT];
+} SAMPLE;
+
+static SAMPLE samples[MAX_SAMPLES];
+static int sample_count = 0;
+
+// get the (short) git revision of the working directory
+void current_rev(char *rev)
+{
+    FILE *git = popen("git rev-parse --short HEAD 2>/dev/null", "r");
+    if (git == NULL || fgets(rev, NAME_LEN, git) == NULL) {
+	fprintf(stderr, "ERROR: Could not determine the git revision (pass it with -rev)\n");
+	exit(1);
+    }
+    pclose(git);
+    rev[strcspn(rev, "\r\n")] = '\0';
+}
+
+/*
+RUNNING THE SUITE
+*****************
+*/
+
+// write a large (but quick to run) program to measure the assembler with
+void write_large_source(const char *file_name)
+{
+    FILE *file = fopen(file_name, "w");
+    if (file == NULL) {
+	fprintf(stderr, "ERROR: Could not create %s\n", file_name);
+	exit(1);
+    }
+
+    fprintf(file, "// generated by tasm-bench\n\nmain:\n");
+    for (int i = 0; i < LARGE_SOURCE_LINES; i++) {
+	fprintf(file, "\tmov\t0x%x\t\t0x%x\t// line %d\n", 5 + i % 1000, 5 + (i * 7) % 1000, i);
+    }
+    fclose(file);
+}
+
+// run one workload once, and append its measurements to the results file
+int run_workload(const char *tasm, const char *rev, const char *workload, const char *file_name, FILE *results)
+{
+    char err_name[] = "/tmp/tasm-bench-XXXXXX";
+    int fd = mkstemp(err_name);
+    if (fd < 0) return 0;
+    close(fd);
+
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "\"%s\" \"%s\" -bench > /dev/null 2> %s", tasm, file_name, err_name);
+    int status = system(cmd);
+
+    FILE *err = fopen(err_name, "r");
+    char line[512];
+    unsigned long lines = 0, assemble_ns = 0, steps = 0, run_ns = 0, output_bytes = 0;
+    int found = 0;
+
+    while (err != NULL && fgets(line, sizeof(line), err) != NULL) {
+	if (sscanf(line, "BENCH lines=%lu assemble_ns=%lu steps=%lu run_ns=%lu output_bytes=%lu",
+		   &lines, &assemble_ns, &steps, &run_ns, &output_bytes) == 5) found = 1;
+    }
+    if (err != NULL) fclose(err);
+    unlink(err_name);
+
+    if (status != 0 || !found) {
+	fprintf(stderr, "ERROR: Workload %s failed under %s\n", workload, tasm);
+	return 0;
+    }
+
+    double steps_per_sec = (run_ns && steps >= MIN_STEPS) ? steps * 1e9 / run_ns : 0;
+    double lines_per_sec = (assemble_ns && lines >= MIN_LINES) ? lines * 1e9 / assemble_ns : 0;
+    double output_per_sec = (run_ns && output_bytes >= MIN_OUTPUT_BYTES) ? output_bytes * 1e9 / run_ns : 0;
+
+    fprintf(results, "%s %s %.0f %.0f %.0f\n", rev, workload, steps_per_sec, lines_per_sec, output_per_sec);
+    printf("%-16s %14.0f %14.0f %18.0f\n", workload, steps_per_sec, lines_per_sec, output_per_sec);
+    return 1;
+}
+
+int run_suite(const char *tasm, const char *rev, int runs, const char *suite, const char *results_name)
+{
+    FILE *results = fopen(results_name, "a");
+    if (results == NULL) {
+	fprintf(stderr, "ERROR: Could not open %s\n", results_name);
+	return 1;
+    }
+
+    char large_name[] = "/tmp/tasm-bench-large-XXXXXX.tasm";
+    int fd = mkstemps(large_name, 5);
+    if (fd < 0) {
+	fprintf(stderr, "ERROR: Could not create a temporary file\n");
+	return 1;
+    }
+    close(fd);
+    write_large_source(large_name);
+
+    DIR *dir = opendir(suite);
+    if (dir == NULL) {
+	fprintf(stderr, "ERROR: Could not open the suite directory %s\n", suite);
+	return 1;
+    }
+
+    printf("revision %s, %d run(s) per workload\n\n", rev, runs);
+    printf("%-16s %14s %14s %18s\n", "WORKLOAD", "STEPS/SEC", "LINES/SEC", "OUTPUT BYTES/SEC");
+
+    int ok = 1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+	size_t len = strlen(entry->d_name);
+	if (len < 6 || strcmp(entry->d_name + len - 5, ".tasm") != 0) continue;
+
+	char file_name[1024], workload[NAME_LEN];
+	snprintf(file_name, sizeof(file_name), "%s/%s", suite, entry->d_name);
+	snprintf(workload, sizeof(workload), "%.*s", (int)(len - 5), entry->d_name);
+
+	for (int i = 0; i < runs; i++) ok &= run_workload(tasm, rev, workload, file_name, results);
+    }
+    closedir(dir);
+
+    for (int i = 0; i < runs; i++) ok &= run_workload(tasm, rev, "asm-large", large_name, results);
+
+    unlink(large_name);
+    fclose(results);
+    return ok ? 0 : 1;
+}
+
+/*
+COMPARING RESULTS
+*****************
+*/
+
+void load_results(const char *results_name)
+{
+    FILE *results = fopen(results_name, "r");
+    if (results == NULL) {
+	fprintf(stderr, "ERROR: Could not open %s\n", results_name);
+	exit(1);
+    }
+
+    char line[512];
+    while (sample_count < MAX_SAMPLES && fgets(line, sizeof(line), results) != NULL) {
+	SAMPLE *s = &samples[sample_count];
+	if (sscanf(line, "%127s %127s %lf %lf %lf", s->rev, s->workload,
+		   &s->metrics[0], &s->metrics[1], &s->metrics[2]) == 5) sample_count++;
+    }
+    fclose(results);
+}
+
+// continued fraction for the regularized incomplete beta function
+double beta_cf(double a, double b, double x)
+{
+    double qab = a + b, qap = a + 1, qam = a - 1;
+    double c = 1, d = 1 - qab * x / qap;
+    if (fabs(d) < 1e-300) d = 1e-300;
+    d = 1 / d;
+    double h = d;
+
+    for (int m = 1; m <= 300; m++) {
+	int m2 = 2 * m;
+	double aa = m * (b - m) * x / ((qam + m2) * (a + m2));
+
+	d = 1 + aa * d;
+	if (fabs(d) < 1e-300) d = 1e-300;
+	c = 1 + aa / c;
+	if (fabs(c) < 1e-300) c = 1e-300;
+	d = 1 / d;
+	h *= d * c;
+
+	aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2));
+	d = 1 + aa * d;
+	if (fabs(d) < 1e-300) d = 1e-300;
+	c = 1 + aa / c;
+	if (fabs(c) < 1e-300) c = 1e-300;
+	d = 1 / d;
+
+	double del = d * c;
+	h *= del;
+	if (fabs(del - 1) < 1e-12) break;
+    }
+    return h;
+}
+
+// regularized incomplete beta function I_x(a, b)
+double incomplete_beta(double a, double b, double x)
+{
+    if (x <= 0) return 0;
+    if (x >= 1) return 1;
+
+    double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x));
+    if (x < (a + 1) / (a + b + 2)) return front * beta_cf(a, b, x) / a;
+    return 1 - front * beta_cf(b, a, 1 - x) / b;
+}
+
+// two-sided p-value of Welch's t-test
+double welch_p_value(const double *x, int nx, const double *y, int ny)
+{
+    double mx = 0, my = 0, vx = 0, vy = 0;
+
+    for (int i = 0; i < nx; i++) mx += x[i];
+    for (int i = 0; i < ny; i++) my += y[i];
+    mx /= nx;
+    my /= ny;
+
+    for (int i = 0; i < nx; i++) vx += (x[i] - mx) * (x[i] - mx);
+    for (int i = 0; i < ny; i++) vy += (y[i] - my) * (y[i] - my);
+    vx = nx > 1 ? vx / (nx - 1) : 0;
+    vy = ny > 1 ? vy / (ny - 1) : 0;
+
+    double se2 = vx / nx + vy / ny;
+    if (se2 == 0) return mx == my ? 1 : 0;
+
+    double t = (mx - my) / sqrt(se2);
+    double df = se2 * se2 / ((vx / nx) * (vx / nx) / (nx > 1 ? nx - 1 : 1) + (vy / ny) * (vy / ny) / (ny > 1 ? ny - 1 : 1));
+
+    return incomplete_beta(df / 2, 0.5, df / (df + t * t));
+}
+
+// collect the values of one metric of a workload under a revision
+int collect(const char *rev, const char *workload, int metric, double *out)
+{
+    int n = 0;
+    for (int i = 0; i < sample_count; i++) {
+	if (strcmp(samples[i].rev, rev) == 0 && strcmp(samples[i].workload, workload) == 0) out[n++] = samples[i].metrics[metric];
+    }
+    return n;
+}
+
+double mean(const double *x, int n)
+{
+    double sum = 0;
+    for (int i = 0; i < n; i++) sum += x[i];
+    return sum / n;
+}
+
+int compare(const char *base_rev, const char *rev, double threshold, double alpha, const char *results_name)
+{
+    load_results(results_name);
+
+    static double base[MAX_SAMPLES], curr[MAX_SAMPLES];
+    int regressions = 0, compared = 0;
+
+    printf("comparing %s against %s (threshold %.1f%%, alpha %.3f)\n\n", rev, base_rev, threshold, alpha);
+    printf("%-16s %-18s %14s %14s %9s %9s\n", "WORKLOAD", "METRIC", "BASE", "CURRENT", "CHANGE", "P-VALUE");
+
+    for (int i = 0; i < sample_count; i++) {
+	const char *workload = samples[i].workload;
+
+	// visit every workload once (the first time it appears for the base revision)
+	if (strcmp(samples[i].rev, base_rev) != 0) continue;
+	int seen = 0;
+	for (int j = 0; j < i && !seen; j++) {
+	    seen = strcmp(samples[j].rev, base_rev) == 0 && strcmp(samples[j].workload, workload) == 0;
+	}
+	if (seen) continue;
+
+	for (int metric = 0; metric < METRIC_COUNT; metric++) {
+	    int nb = collect(base_rev, workload, metric, base);
+	    int nc = collect(rev, workload, metric, curr);
+	    if (nc == 0) continue;
+
+	    double mb = mean(base, nb), mc = mean(curr, nc);
+	    if (mb == 0) continue; // the workload does not exercise this metric
+
+	    double change = (mc - mb) / mb * 100;
+	    double p = welch_p_value(base, nb, curr, nc);
+	    int regressed = change < -threshold && p < alpha;
+
+	    printf("%-16s %-18s %14.0f %14.0f %8.1f%% %9.4f%s\n",
+		   workload, metric_names[metric], mb, mc, change, p, regressed ? "  REGRESSION" : "");
+	    regressions += regressed;
+	    compared++;
+	}
+    }
+
+    if (compared == 0) {
+	fprintf(stderr, "ERROR: No results to compare for %s and %s\n", base_rev, rev);
+	return 1;
+    }
+
+    printf("\n%d regression(s)\n", regressions);
+    return regressions > 0;
+}
+
+void usage()
+{
+    fprintf(stderr, "Usage:\n"
+	    "    tasm-bench run <TASM_BINARY> [-rev <REV>] [-n <RUNS>] [-suite <DIR>] [-results <FILE>]\n"
+	    "    tasm-bench compare <BASE_REV> [<REV>] [-threshold <PCT>] [-alpha <P>] [-results <FILE>]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) usage();
+
+    const char *command = argv[1];
+    const char *target = argv[2];
+    const char *results_name = DEFAULT_RESULTS;
+    const char *suite = DEFAULT_SUITE;
+    char rev[NAME_LEN] = "";
+    int runs = DEFAULT_RUNS;
+    double threshold = 5, alpha = 0.05;
+
+    for (int i = 3; i < argc; i++) {
+	if (strcmp(argv[i], "-rev") == 0 && i + 1 < argc) snprintf(rev, sizeof(rev), "%s", argv[++i]);
+	else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) runs = atoi(argv[++i]);
+	else if (strcmp(argv[i], "-suite") == 0 && i + 1 < argc) suite = argv[++i];
+	else if (strcmp(argv[i], "-results") == 0 && i + 1 < argc) results_name = argv[++i];
+	else if (strcmp(argv[i], "-threshold") == 0 && i + 1 < argc) threshold = atof(argv[++i]);
+	else if (strcmp(argv[i], "-alpha") == 0 && i + 1 < argc) alpha = atof(argv[++i]);
+	else if (argv[i][0] != '-' && rev[0] == '\0') snprintf(rev, sizeof(rev), "%s", argv[i]);
+	else usage();
+    }
+
+    if (rev[0] == '\0') current_rev(rev);
+    if (runs < 1) runs = 1;
+
+    if (strcmp(command, "run") == 0) return run_suite(target, rev, runs, suite, results_name);
+    if (strcmp(command, "compare") == 0) return compare(target, rev, threshold, alpha, results_name);
+    usage();
+    return 1;
+}
@@ -0,0 +1,490 @@
+/*
+    MIT License
+
+    Copyright (c) 2025 Rachit Dhar
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+*/
+
+/*
+TASM-DIFF
+*********
+
+Checks that every execution engine of tasm.c behaves exactly like the reference
+engine ("switch"), by running the same programs under all of them (see "-engines")
+and comparing the results.
+
+    tasm-diff <TASM_BINARY> <FILE.tasm>... [-every <N>]
+
+	Runs the given programs under every engine.
+
+    tasm-diff <TASM_BINARY> -random <COUNT> [-seed <SEED>] [-keep <DIR>] [-every <N>]
+
+	Generates COUNT random (but well-formed and terminating) programs and runs
+	them under every engine. Programs that diverge are kept in DIR (the current
+	directory by default), as diverged-<SEED>.tasm, so that they can be re-run.
+
+For every engine, the exit status, the stdout and stderr bytes, the state hashes
+(written every N steps, 64 by default, see "-state" in tasm.c) and the full tape at
+halt must match those of the reference engine. On a mismatch, the window of steps in
+which the state first diverged and the first differing cells are reported.
+
+Exits with status 1 if any program diverged.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_ENGINES 16
+#define NAME_LEN 64
+#define MAX_REPORTED_CELLS 8
+
+// must match BLOCK in tasm.c
+typedef struct {
+    int ins;
+    unsigned long data;
+    unsigned char dtype;
+} BLOCK;
+
+typedef struct {
+    int status;
+    char *out, *err, *state;
+    long out_len, err_len, state_len;
+    BLOCK *tape;
+    long tape_len;
+} RESULT;
+
+static char engines[MAX_ENGINES][NAME_LEN];
+static int engine_count = 0;
+static char work_dir[] = "/tmp/tasm-diff-XXXXXX";
+
+// read a whole file into memory (returns NULL if it cannot be read)
+char *read_file(const char *file_name, long *len)
+{
+    *len = 0;
+    FILE *file = fopen(file_name, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *data = malloc(size + 1);
+    *len = fread(data, 1, size, file);
+    data[*len] = '\0';
+    fclose(file);
+    return data;
+}
+
+void load_engines(const char *tasm)
+{
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "\"%s\" -engines", tasm);
+
+    FILE *list = popen(cmd, "r");
+    char line[NAME_LEN];
+    while (list != NULL && engine_count < MAX_ENGINES && fgets(line, sizeof(line), list) != NULL) {
+	line[strcspn(line, "\n")] = '\0';
+	if (line[0] != '\0') strcpy(engines[engine_count++], line);
+    }
+    if (list != NULL) pclose(list);
+
+    if (engine_count == 0) {
+	fprintf(stderr, "ERROR: %s did not list any engines\n", tasm);
+	exit(1);
+    }
+}
+
+// run a program under one engine
+RESULT run_engine(const char *tasm, const char *file_name, const char *engine, unsigned long every)
+{
+    char out_name[300], err_name[300], state_name[300], tape_name[320], cmd[2048];
+    snprintf(out_name, sizeof(out_name), "%s/%s.out", work_dir, engine);
+    snprintf(err_name, sizeof(err_name), "%s/%s.err", work_dir, engine);
+    snprintf(state_name, sizeof(state_name), "%s/%s.state", work_dir, engine);
+    snprintf(tape_name, sizeof(tape_name), "%s.tape", state_name);
+    unlink(state_name);
+    unlink(tape_name);
+
+    snprintf(cmd, sizeof(cmd), "\"%s\" \"%s\" -engine %s -state %s -state-every %lu > %s 2> %s",
+	     tasm, file_name, engine, state_name, every, out_name, err_name);
+
+    RESULT result;
+    result.status = system(cmd);
+    result.out = read_file(out_name, &result.out_len);
+    result.err = read_file(err_name, &result.err_len);
+    result.state = read_file(state_name, &result.state_len);
+    result.tape = (BLOCK *)read_file(tape_name, &result.tape_len);
+    result.tape_len /= sizeof(BLOCK);
+    return result;
+}
+
+void free_result(RESULT *result)
+{
+    free(result->out);
+    free(result->err);
+    free(result->state);
+    free(result->tape);
+}
+
+// offset of the first differing byte (or -1 if both are the same)
+long first_difference(const char *a, long a_len, const char *b, long b_len)
+{
+    long len = a_len < b_len ? a_len : b_len;
+    for (long i = 0; i < len; i++) {
+	if (a[i] != b[i]) return i;
+    }
+    return a_len == b_len ? -1 : len;
+}
+
+// report the window of steps in which the state hashes first diverged
+int compare_states(const char *engine, const RESULT *base, const RESULT *other)
+{
+    if (base->state == NULL || other->state == NULL) {
+	if (base->state == other->state) return 1;
+	printf("    %s: state written by only one of the engines\n", engine);
+	return 0;
+    }
+
+    char *a_save, *b_save;
+    char *a_copy = strdup(base->state), *b_copy = strdup(other->state);
+    char *a = strtok_r(a_copy, "\n", &a_save), *b = strtok_r(b_copy, "\n", &b_save);
+    unsigned long last_match = 0;
+    int same = 1;
+
+    while (a != NULL || b != NULL) {
+	if (a == NULL || b == NULL || strcmp(a, b) != 0) {
+	    unsigned long step = 0;
+	    const char *line = a != NULL ? a : b;
+	    if (sscanf(line, "step %lu", &step) != 1) sscanf(line, "final %lu", &step);
+
+	    printf("    %s: state diverged between step %lu and step %lu\n", engine, last_match, step);
+	    printf("      %-8s %s\n      %-8s %s\n", engines[0], a ? a : "(end)", engine, b ? b : "(end)");
+	    same = 0;
+	    break;
+	}
+	sscanf(a, "step %lu", &last_match);
+	a = strtok_r(NULL, "\n", &a_save);
+	b = strtok_r(NULL, "\n", &b_save);
+    }
+    free(a_copy);
+    free(b_copy);
+    return same;
+}
+
+// report the first differing cells of the tape at halt
+int compare_tapes(const char *engine, const RESULT *base, const RESULT *other)
+{
+    if (base->tape_len != other->tape_len) {
+	if (base->tape_len == 0 || other->tape_len == 0) return 1; // (a runtime error, already reported)
+	printf("    %s: tape sizes differ (%ld and %ld cells)\n", engine, base->tape_len, other->tape_len);
+	return 0;
+    }
+
+    int reported = 0;
+    for (long i = 0; i < base->tape_len && reported < MAX_REPORTED_CELLS; i++) {
+	const BLOCK *x = &base->tape[i], *y = &other->tape[i];
+	if (x->ins == y->ins && x->data == y->data && x->dtype == y->dtype) continue;
+
+	printf("    %s: cell 0x%lx differs: ins 0x%x data 0x%lx dtype %u (%s), ins 0x%x data 0x%lx dtype %u (%s)\n",
+	       engine, i, x->ins, x->data, x->dtype, engines[0], y->ins, y->data, y->dtype, engine);
+	reported++;
+    }
+    return reported == 0;
+}
+
+// run a program under every engine (returns 1 if they all agree)
+int check_program(const char *tasm, const char *file_name, unsigned long every)
+{
+    RESULT base = run_engine(tasm, file_name, engines[0], every);
+    int same = 1;
+
+    for (int e = 1; e < engine_count; e++) {
+	RESULT other = run_engine(tasm, file_name, engines[e], every);
+	int engine_same = 1;
+
+	if (base.status != other.status) {
+	    printf("    %s: exit status %d (%s: %d)\n", engines[e], other.status, engines[0], base.status);
+	    engine_same = 0;
+	}
+
+	long diff = first_difference(base.out, base.out_len, other.out, other.out_len);
+	if (diff >= 0) {
+	    printf("    %s: stdout differs at byte %ld (%ld and %ld bytes)\n", engines[e], diff, base.out_len, other.out_len);
+	    engine_same = 0;
+	}
+
+	diff = first_difference(base.err, base.err_len, other.err, other.err_len);
+	if (diff >= 0) {
+	    printf("    %s: stderr differs at byte %ld\n      %-8s %s\n      %-8s %s\n",
+		   engines[e], diff, engines[0], base.err, engines[e], other.err);
+	    engine_same = 0;
+	}
+
+	if (!compare_states(engines[e], &base, &other)) engine_same = 0;
+	if (!compare_tapes(engines[e], &base, &other)) engine_same = 0;
+
+	if (!engine_same) same = 0;
+	free_result(&other);
+    }
+    free_result(&base);
+
+    printf("%-8s %s\n", same ? "OK" : "DIVERGED", file_name);
+    return same;
+}
+
+/*
+RANDOM PROGRAMS
+***************
+
+The generated programs only use storage cells 0x10-0x3F, laid out as:
+
+    0x10-0x2F   data cells (written by the program)
+    0x30-0x37   pointer cells (always hold a data cell address, for dereferencing)
+    0x38-0x3C   constant cells (nonzero and small, the sources of div and shifts)
+    0x3D, 0x3E  the constants 0 and 1
+    0x3F        the loop counter of main
+
+Every program terminates: main runs a single counter loop, routines only call
+routines defined before them (so there is no recursion), and conditional jumps
+only go forward to a "tail" (defined before the routine, as labels must be) which
+ends in a ret. Some programs also have a coroutine, an endless loop that yields
+after every pass, which main resumes now and then. The loop of main can also clone
+the machine, with the clone running a few instructions before it hands back a cell
+(which the original joins right away). The clk and tsc instructions are left out, as their results differ
+between any two runs.
+*/
+
+#define DATA_CELLS 0x20
+#define DATA_START 0x10
+#define POINTER_START 0x30
+#define CONSTANT_START 0x38
+#define CONSTANT_COUNT 5
+#define ZERO 0x3D
+#define ONE 0x3E
+#define COUNTER 0x3F
+
+static const char *binary_ops[] = { "mov", "add", "sub", "mul", "and", "or", "xor" };
+static const char *jumps[] = { "je", "jne", "jg", "jge", "jl", "jle" };
+static const char *float_unary_ops[] = { "itof", "ftoi", "fsqrt" };
+static const char *float_binary_ops[] = { "fadd", "fsub", "fmul", "fdiv" };
+static const char *raw_formats[] = { "u8", "u32", "u64" };
+static const char *signed_jumps[] = { "jlt", "jgt" };
+static const char *chars = "abcdefghijklmnopqrstuvwxyz0123456789 .,:";
+
+unsigned long data_cell() { return DATA_START + rand() % DATA_CELLS; }
+unsigned long pointer_cell() { return POINTER_START + rand() % 8; }
+unsigned long constant_cell() { return CONSTANT_START + rand() % CONSTANT_COUNT; }
+
+// write one random (non jumping) instruction
+void write_op(FILE *file)
+{
+    switch (rand() % 13) {
+    case 0:
+	fprintf(file, "\tput\t0x%lx\t\t%d\n", data_cell(), rand() % 100000);
+	break;
+    case 1:
+	fprintf(file, "\tnot\t0x%lx\n", data_cell());
+	break;
+    case 2:
+	fprintf(file, "\t%s\t0x%lx\t\t0x%lx\n", rand() % 2 ? "lsh" : "rsh", data_cell(), constant_cell());
+	break;
+    case 3:
+	fprintf(file, "\tdiv\t0x%lx\t\t0x%lx\n", data_cell(), constant_cell());
+	break;
+    case 4:
+	fprintf(file, "\t%s\t0x%lx\t\t[0x%lx]\n", binary_ops[rand() % 7], data_cell(), pointer_cell());
+	break;
+    case 5:
+	fprintf(file, "\tmov\t[0x%lx]\t\t0x%lx\n", pointer_cell(), data_cell());
+	break;
+    case 6:
+	fprintf(file, "\tsteps\t0x%lx\n", data_cell());
+	break;
+    case 7:
+	fprintf(file, "\tmov\t[0x3]\t\t0x%lx\n", data_cell());
+	break;
+    case 8:
+	if (rand() % 4 == 0) {
+	    // an escape sequence (decoded by the assembler into a single char)
+	    fprintf(file, "\tput\t[0x3]\t\t\"\\%c\"\n", "nrt\\\"0"[rand() % 6]);
+	} else {
+	    fprintf(file, "\tput\t[0x3]\t\t\"%c\"\n", chars[rand() % strlen(chars)]);
+	}
+	break;
+    case 9:
+	if (rand() % 3 == 0) fprintf(file, "\tput\t0x%lx\t\t%d.%d\n", data_cell(), rand() % 1000, rand() % 100);
+	else if (rand() % 2) fprintf(file, "\t%s\t0x%lx\n", float_unary_ops[rand() % 3], data_cell());
+	else fprintf(file, "\t%s\t0x%lx\t\t0x%lx\n", float_binary_ops[rand() % 4], data_cell(), data_cell());
+	break;
+    case 10:
+	if (rand() % 3 == 0) fprintf(file, "\tput\t0x%lx\t\t-%d\n", data_cell(), rand() % 100000);
+	else if (rand() % 2) fprintf(file, "\timul\t0x%lx\t\t0x%lx\n", data_cell(), data_cell());
+	else fprintf(file, "\t%s\t0x%lx\t\t0x%lx\n", rand() % 2 ? "idiv" : "sar", data_cell(), constant_cell());
+	break;
+    case 11:
+	fprintf(file, "\toutraw\t0x%x\t\t%d\t%s\n", DATA_START, 1 + rand() % DATA_CELLS, raw_formats[rand() % 3]);
+	break;
+    default:
+	fprintf(file, "\t%s\t0x%lx\t\t0x%lx\n", binary_ops[rand() % 7], data_cell(), data_cell());
+	break;
+    }
+}
+
+// write a vfork, whose clone runs a few instructions and exits with a cell that the original joins
+void write_fork(FILE *file, int fork)
+{
+    unsigned long flag = data_cell();
+    fprintf(file, "\tvfork\t0x%lx\n", flag);
+    fprintf(file, "\tcmp\t0x%lx\t\t0x%x\n", flag, ONE);
+    fprintf(file, "\tjne\tj%d\n", fork);
+    for (int i = 1 + rand() % 4; i > 0; i--) write_op(file);
+    fprintf(file, "\tvexit\t0x%lx\n", data_cell());
+    fprintf(file, "j%d:\n", fork);
+    fprintf(file, "\tvjoin\t0x%lx\n", data_cell());
+}
+
+void write_random_program(const char *file_name, unsigned int seed)
+{
+    FILE *file = fopen(file_name, "w");
+    if (file == NULL) {
+	fprintf(stderr, "ERROR: Could not create %s\n", file_name);
+	exit(1);
+    }
+    srand(seed);
+    fprintf(file, "// generated by tasm-diff (seed %u)\n\n", seed);
+
+    int tails = 1 + rand() % 3;
+    for (int t = 0; t < tails; t++) {
+	fprintf(file, "t%d:\n", t);
+	for (int i = rand() % 4; i > 0; i--) write_op(file);
+	fprintf(file, "\tret\n\n");
+    }
+
+    int routines = 1 + rand() % 6;
+    for (int r = 0; r < routines; r++) {
+	fprintf(file, "r%d:\n", r);
+	for (int i = 2 + rand() % 10; i > 0; i--) {
+	    int kind = rand() % 8;
+	    if (kind == 0 && r > 0) {
+		fprintf(file, "\tcall\tr%d\n", rand() % r);
+	    } else if (kind == 1) {
+		fprintf(file, "\tcmp\t0x%lx\t\t0x%lx\n", data_cell(), data_cell());
+		fprintf(file, "\t%s\tt%d\n", jumps[rand() % 6], rand() % tails);
+	    } else if (kind == 2) {
+		fprintf(file, "\ticmp\t0x%lx\t\t0x%lx\n", data_cell(), data_cell());
+		fprintf(file, "\t%s\tt%d\n", signed_jumps[rand() % 2], rand() % tails);
+	    } else write_op(file);
+	}
+	fprintf(file, "\tret\n\n");
+    }
+
+    int coroutine = rand() % 2;
+    if (coroutine) {
+	fprintf(file, "co:\n");
+	for (int i = 1 + rand() % 6; i > 0; i--) {
+	    if (rand() % 4 == 0) fprintf(file, "\tcall\tr%d\n", rand() % routines);
+	    else write_op(file);
+	}
+	fprintf(file, "\tyield\t0\n");
+	fprintf(file, "\tjmp\tco\n\n");
+    }
+
+    fprintf(file, "main:\n");
+    for (int i = 0; i < DATA_CELLS; i++) fprintf(file, "\tput\t0x%x\t\t%d\n", DATA_START + i, rand() % 1000);
+    for (int i = 0; i < 8; i++) fprintf(file, "\tput\t0x%x\t\t0x%lx\n", POINTER_START + i, data_cell());
+    for (int i = 0; i < CONSTANT_COUNT; i++) fprintf(file, "\tput\t0x%x\t\t%d\n", CONSTANT_START + i, 1 + rand() % 7);
+    fprintf(file, "\tput\t0x%x\t\t0\n", ZERO);
+    fprintf(file, "\tput\t0x%x\t\t1\n", ONE);
+    fprintf(file, "\tput\t0x%x\t\t%d\n", COUNTER, 1 + rand() % 50);
+    if (coroutine) fprintf(file, "\tcocreate\t0\tco\n");
+
+    fprintf(file, "loop:\n");
+    for (int i = 1 + rand() % 8, forks = 0; i > 0; i--) {
+	if (rand() % 3 == 0) fprintf(file, "\tcall\tr%d\n", rand() % routines);
+	else if (coroutine && rand() % 3 == 0) fprintf(file, "\tresume\t0\n");
+	else if (rand() % 8 == 0) write_fork(file, forks++);
+	else write_op(file);
+    }
+    fprintf(file, "\tout\n");
+    fprintf(file, "\tput\t0x3\t\t101000\n"); // rewind the display
+    fprintf(file, "\tsub\t0x%x\t\t0x%x\n", COUNTER, ONE);
+    fprintf(file, "\tcmp\t0x%x\t\t0x%x\n", COUNTER, ZERO);
+    fprintf(file, "\tjne\tloop\n");
+    fprintf(file, "\thlt\n");
+    fclose(file);
+}
+
+void usage()
+{
+    fprintf(stderr, "Usage:\n"
+	    "    tasm-diff <TASM_BINARY> <FILE.tasm>... [-every <N>]\n"
+	    "    tasm-diff <TASM_BINARY> -random <COUNT> [-seed <SEED>] [-keep <DIR>] [-every <N>]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) usage();
+
+    const char *tasm = argv[1];
+    const char *keep_dir = ".";
+    unsigned long every = 64;
+    unsigned int seed = 1;
+    int random_count = 0;
+    int file_count = 0;
+    char **files = malloc(sizeof(char *) * argc);
+
+    for (int i = 2; i < argc; i++) {
+	if (strcmp(argv[i], "-every") == 0 && i + 1 < argc) every = strtoul(argv[++i], NULL, 0);
+	else if (strcmp(argv[i], "-random") == 0 && i + 1 < argc) random_count = atoi(argv[++i]);
+	else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) seed = strtoul(argv[++i], NULL, 0);
+	else if (strcmp(argv[i], "-keep") == 0 && i + 1 < argc) keep_dir = argv[++i];
+	else if (argv[i][0] == '-') usage();
+	else files[file_count++] = argv[i];
+    }
+    if (file_count == 0 && random_count == 0) usage();
+
+    if (mkdtemp(work_dir) == NULL) {
+	fprintf(stderr, "ERROR: Could not create a working directory\n");
+	return 1;
+    }
+    load_engines(tasm);
+
+    int diverged = 0;
+    for (int i = 0; i < file_count; i++) {
+	if (!check_program(tasm, files[i], every)) diverged++;
+    }
+
+    for (int i = 0; i < random_count; i++, seed++) {
+	char file_name[300];
+	snprintf(file_name, sizeof(file_name), "%s/random-%u.tasm", work_dir, seed);
+	write_random_program(file_name, seed);
+
+	if (!check_program(tasm, file_name, every)) {
+	    char kept_name[1024], cmd[2048];
+	    snprintf(kept_name, sizeof(kept_name), "%s/diverged-%u.tasm", keep_dir, seed);
+	    snprintf(cmd, sizeof(cmd), "cp \"%s\" \"%s\"", file_name, kept_name);
+	    if (system(cmd) == 0) printf("    kept as %s\n", kept_name);
+	    diverged++;
+	}
+	unlink(file_name);
+    }
+
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", work_dir);
+    if (system(cmd) != 0) fprintf(stderr, "WARNING: Could not remove %s\n", work_dir);
+
+    printf("\n%d of %d program(s) diverged\n", diverged, file_count + random_count);
+    return diverged ? 1 : 0;
+}
@@ -0,0 +1,140 @@
+/*
+    MIT License
+
+    Copyright (c) 2025 Rachit Dhar
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+*/
+
+/*
+TASM-TOP
+********
+
+Lists all live TASM machines on the host, by reading the statistics
+segments that every machine publishes into shared memory (see tasm_stats.h).
+
+Usage:
+
+    tasm-top            refresh the list every second (until interrupted)
+    tasm-top -1         print the list once and exit
+    tasm-top -d <SECS>  refresh the list every SECS seconds
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../tasm_stats.h"
+
+#define SHM_DIR "/dev/shm"
+
+// copy a consistent snapshot of the statistics segment
+// (returns 0 if the segment is not a valid, live TASM machine)
+int read_stats(const char *name, TASM_STATS *out)
+{
+    char path[300];
+    snprintf(path, sizeof(path), "/%s", name);
+
+    int fd = shm_open(path, O_RDONLY, 0);
+    if (fd < 0) return 0;
+
+    TASM_STATS *block = mmap(NULL, sizeof(TASM_STATS), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (block == MAP_FAILED) return 0;
+
+    int ok = 0;
+    for (int attempt = 0; attempt < 100; attempt++) {
+	unsigned long seq = block->seq;
+	if (seq & 1) continue;
+
+	__sync_synchronize();
+	memcpy(out, block, sizeof(TASM_STATS));
+	__sync_synchronize();
+
+	if (block->seq == seq) {
+	    ok = 1;
+	    break;
+	}
+    }
+    munmap(block, sizeof(TASM_STATS));
+
+    if (!ok || out->magic != TASM_STATS_MAGIC) return 0;
+
+    // segments left behind by machines that were killed are skipped
+    if (kill((pid_t)out->pid, 0) != 0 && errno != EPERM) return 0;
+
+    out->label[TASM_STATS_NAME_LEN - 1] = '\0';
+    out->program[TASM_STATS_NAME_LEN - 1] = '\0';
+    return 1;
+}
+
+// print one line for every live machine
+void list_machines()
+{
+    DIR *dir = opendir(SHM_DIR);
+    if (dir == NULL) {
+	fprintf(stderr, "ERROR: Could not open " SHM_DIR);
+	exit(1);
+    }
+
+    printf("%8s %16s %14s %10s %-20s %6s %8s  %s\n",
+	   "PID", "STEPS", "STEPS/SEC", "POS", "LABEL", "STACK", "DISPLAY", "PROGRAM");
+
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+	if (strncmp(entry->d_name, TASM_STATS_PREFIX, strlen(TASM_STATS_PREFIX)) != 0) continue;
+
+	TASM_STATS s;
+	if (!read_stats(entry->d_name, &s)) continue;
+
+	printf("%8lu %16lu %14lu 0x%08lx %-20s %6lu %8lu  %s\n",
+	       s.pid, s.steps, s.steps_per_sec, s.pos, s.label, s.stack_depth, s.display_fill, s.program);
+	count++;
+    }
+    closedir(dir);
+
+    printf("\n%d machine(s) running\n", count);
+}
+
+int main(int argc, char **argv)
+{
+    int once = 0;
+    int delay = 1;
+
+    for (int i = 1; i < argc; i++) {
+	if (strcmp(argv[i], "-1") == 0) once = 1;
+	else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) delay = atoi(argv[++i]);
+	else {
+	    fprintf(stderr, "Usage: tasm-top [-1] [-d <SECS>]\n");
+	    return 1;
+	}
+    }
+    if (delay < 1) delay = 1;
+
+    if (once) {
+	list_machines();
+	return 0;
+    }
+
+    while (1) {
+	printf("\033[H\033[2J"); // clear the terminal
+	list_machines();
+	fflush(stdout);
+	sleep(delay);
+    }
+}